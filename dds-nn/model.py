@@ -1,21 +1,109 @@
 import os
 import json
+import struct
+from array import array
 import torch
 import torchaudio
 import torch.nn as nn
 
 
+# Recurrent cell types and their gate counts. The JSON export keys follow the
+# cell, lstm.* or gru.*, which is how the C++ loaders tell them apart.
+CELL_GATES = {"lstm": 4, "gru": 3}
+CELL_MODULES = {"lstm": nn.LSTM, "gru": nn.GRU}
+
+QUANTIZED_WEIGHTS = [f"{cell}.{weight}" for cell in CELL_GATES for weight in ["weight_ih_l0", "weight_hh_l0"]]
+QUANTIZED_WEIGHTS.append("linear.weight")
+
+
+# Symmetric int8 quantization of the weight matrices with one scale per row.
+# Each weight is stored as round(w / scale) in [-127, 127] and its row scale as
+# "<name>.scale", so w ~= q * scale. Biases stay in fp32.
+def quantize_state(model_state):
+    quantized_state = {}
+    for item, value in model_state.items():
+        if item in QUANTIZED_WEIGHTS:
+            scale = value.abs().amax(dim=1).clamp(min=1e-12) / 127
+            quantized_state[item] = torch.round(value / scale[:, None]).clamp(-127, 127).to(torch.int8)
+            quantized_state[f"{item}.scale"] = scale
+        else:
+            quantized_state[item] = value
+
+    return quantized_state
+
+
+# Truncated SVD of the recurrent weights, weight_hh ~= u @ v with u of shape
+# (gates * hidden, rank) and v of shape (rank, hidden). An LSTM step then costs
+# (5 * hidden) * rank instead of 4 * hidden * hidden multiply-adds.
+def factorize_recurrent(model_state, rank, cell="lstm"):
+    factorized_state = dict(model_state)
+    weight_hh = factorized_state.pop(f"{cell}.weight_hh_l0")
+    u, s, vh = torch.linalg.svd(weight_hh.float(), full_matrices=False)
+    factorized_state[f"{cell}.weight_hh_l0.u"] = u[:, :rank] * s[:rank]
+    factorized_state[f"{cell}.weight_hh_l0.v"] = vh[:rank]
+    return factorized_state
+
+
+# Binary model container for the C++ loaders, which map the file and use the
+# weights in place. Little endian throughout:
+#   header (64 bytes)   magic "DDS19MDL", then u32 version, cell (0 lstm,
+#                       1 gru), input size, hidden size, gate size, output size,
+#                       recurrent rank (0 when dense) and number of blocks
+#   block table         per block 64 bytes: name (32 bytes, zero padded), u32
+#                       type (0 float32, 1 int8), rows, cols, reserved, then
+#                       u64 offset and size in bytes
+#   blocks              each at an offset that is a multiple of 64
+# The weights are stored ready for inference, the same as the plugin's
+# generated ModelData: both gate biases summed (except the GRU new gate, whose
+# recurrent bias is the recurrent_bias block), sigmoid gate rows scaled by 0.5,
+# and matrices in PyTorch orientation (gates x inputs) in column-major order.
+# weight_hh is replaced by weight_hh_int8 (row-major) and weight_hh_scale for
+# quantized models, or by weight_hh_u and weight_hh_v for factorized ones.
+MODEL_BINARY_MAGIC = b"DDS19MDL"
+MODEL_BINARY_VERSION = 1
+MODEL_BINARY_ALIGNMENT = 64
+MODEL_BINARY_TYPES = {"float32": 0, "int8": 1}
+
+# Gates evaluated as sigmoid(x) = 0.5 * tanh(x / 2) + 0.5
+CELL_SIGMOID_GATES = {"lstm": [0, 1, 3], "gru": [0, 1]}
+
+
+# blocks holds (name, type, rows, cols, values in storage order) tuples
+def write_model_binary(store_path, cell, input_size, hidden_size, output_size, recurrent_rank, blocks):
+    gate_size = CELL_GATES[cell] * hidden_size
+    header = struct.pack("<8s8I24x", MODEL_BINARY_MAGIC, MODEL_BINARY_VERSION, list(CELL_GATES).index(cell),
+                         input_size, hidden_size, gate_size, output_size, recurrent_rank, len(blocks))
+
+    table = b""
+    data = b""
+    offset = len(header) + 64 * len(blocks)
+    for name, block_type, rows, cols, values in blocks:
+        payload = array("b" if block_type == "int8" else "f", values).tobytes()
+        table += struct.pack("<32s4I2Q", name.encode(), MODEL_BINARY_TYPES[block_type], rows, cols, 0, offset + len(data), len(payload))
+        data += payload + bytes(-len(payload) % MODEL_BINARY_ALIGNMENT)
+
+    with open(store_path, "wb") as fp:
+        fp.write(header + table + data)
+
+
+# A GRU has three gates instead of four and no cell state, so it runs with
+# about a quarter fewer operations per step than an LSTM of the same size
 class DDS19Model(nn.Module):
-    def __init__(self, hidden_size):
+    def __init__(self, hidden_size, cell="lstm"):
         super(DDS19Model, self).__init__()
-        self.lstm = nn.LSTM(input_size=3, hidden_size=hidden_size, num_layers=1, batch_first=True)
+        self.cell = cell
+        self.add_module(cell, CELL_MODULES[cell](input_size=3, hidden_size=hidden_size, num_layers=1, batch_first=True))
         self.linear = nn.Linear(in_features=hidden_size, out_features=1)
 
     def forward(self, data_in):
-        lstm_out, _ = self.lstm(data_in)
-        linear_out = self.linear(lstm_out)
+        recurrent_out, _ = self.recurrent()(data_in)
+        linear_out = self.linear(recurrent_out)
         return linear_out
 
+    @torch.jit.ignore
+    def recurrent(self):
+        return getattr(self, self.cell)
+
     @torch.jit.ignore
     def train_epoch(self, loader, device, loss_l1, loss_stft, writer, epoch, scheduler, optimiser):
         train_loss_sum = 0
@@ -99,19 +187,96 @@ class DDS19Model(nn.Module):
 
         return epoch, train_loss, val_loss, optimiser_state_dict
 
+    # Structured pruning of hidden units. A unit is ranked by the energy of its
+    # outgoing weights, recurrent and linear, and the kept units form a smaller
+    # dense model that can be fine-tuned further.
     @torch.jit.ignore
-    def store_json(self, store_dir, store_name):
+    def prune_hidden_units(self, hidden_size):
+        with torch.no_grad():
+            recurrent = self.recurrent()
+            old_hidden_size = recurrent.hidden_size
+            importance = recurrent.weight_hh_l0.pow(2).sum(dim=0) + self.linear.weight.pow(2).sum(dim=0)
+            keep = importance.topk(hidden_size).indices.sort().values
+            gate_rows = torch.cat([keep + gate * old_hidden_size for gate in range(CELL_GATES[self.cell])])
+
+            pruned = DDS19Model(hidden_size, self.cell).to(self.linear.weight.device)
+            pruned_recurrent = pruned.recurrent()
+            pruned_recurrent.weight_ih_l0.copy_(recurrent.weight_ih_l0[gate_rows])
+            pruned_recurrent.weight_hh_l0.copy_(recurrent.weight_hh_l0[gate_rows][:, keep])
+            pruned_recurrent.bias_ih_l0.copy_(recurrent.bias_ih_l0[gate_rows])
+            pruned_recurrent.bias_hh_l0.copy_(recurrent.bias_hh_l0[gate_rows])
+            pruned.linear.weight.copy_(self.linear.weight[:, keep])
+            pruned.linear.bias.copy_(self.linear.bias)
+            return pruned
+
+    @torch.jit.ignore
+    def store_json(self, store_dir, store_name, quantize=False, recurrent_rank=None):
         if not os.path.exists(store_dir):
             os.makedirs(store_dir)
 
         store_path = os.path.join(store_dir, store_name)
         model_state = self.state_dict()
+        if recurrent_rank is not None:
+            model_state = factorize_recurrent(model_state, recurrent_rank, self.cell)
+        if quantize:
+            model_state = quantize_state(model_state)
+
         for item in model_state:
             model_state[item] = model_state[item].tolist()
 
         with open(store_path, 'w') as fp:
             json.dump(model_state, fp)
 
+    # Sibling of store_json in the binary container above, for loaders that
+    # map the file instead of parsing it
+    @torch.jit.ignore
+    def store_binary(self, store_dir, store_name, quantize=False, recurrent_rank=None):
+        if not os.path.exists(store_dir):
+            os.makedirs(store_dir)
+
+        def column_major(tensor):
+            return tensor.detach().float().t().contiguous().flatten().tolist()
+
+        with torch.no_grad():
+            recurrent = self.recurrent()
+            hidden_size = recurrent.hidden_size
+            gate_size = CELL_GATES[self.cell] * hidden_size
+            gate_scale = torch.ones(gate_size)
+            for gate in CELL_SIGMOID_GATES[self.cell]:
+                gate_scale[gate * hidden_size:(gate + 1) * hidden_size] = 0.5
+            gate_scale = gate_scale.to(recurrent.weight_ih_l0.device)
+
+            # The GRU new gate applies its recurrent bias after the reset gate
+            summed_rows = 2 * hidden_size if self.cell == "gru" else gate_size
+            bias = recurrent.bias_ih_l0.clone()
+            bias[:summed_rows] += recurrent.bias_hh_l0[:summed_rows]
+
+            weight_ih = recurrent.weight_ih_l0 * gate_scale[:, None]
+            blocks = [("weight_ih", "float32", gate_size, recurrent.input_size, column_major(weight_ih))]
+
+            weight_hh = recurrent.weight_hh_l0
+            weight_hh_key = f"{self.cell}.weight_hh_l0"
+            if recurrent_rank is not None:
+                factors = factorize_recurrent({weight_hh_key: weight_hh}, recurrent_rank, self.cell)
+                weight_hh_u = factors[f"{weight_hh_key}.u"] * gate_scale[:, None]
+                blocks.append(("weight_hh_u", "float32", gate_size, recurrent_rank, column_major(weight_hh_u)))
+                blocks.append(("weight_hh_v", "float32", recurrent_rank, hidden_size, column_major(factors[f"{weight_hh_key}.v"])))
+            elif quantize:
+                quantized = quantize_state({weight_hh_key: weight_hh})
+                blocks.append(("weight_hh_int8", "int8", gate_size, hidden_size, quantized[weight_hh_key].flatten().tolist()))
+                blocks.append(("weight_hh_scale", "float32", gate_size, 1, (quantized[f"{weight_hh_key}.scale"] * gate_scale).tolist()))
+            else:
+                blocks.append(("weight_hh", "float32", gate_size, hidden_size, column_major(weight_hh * gate_scale[:, None])))
+
+            blocks.append(("bias", "float32", gate_size, 1, (bias * gate_scale).tolist()))
+            if self.cell == "gru":
+                blocks.append(("recurrent_bias", "float32", hidden_size, 1, recurrent.bias_hh_l0[summed_rows:].tolist()))
+            blocks.append(("linear_weight", "float32", self.linear.out_features, hidden_size, column_major(self.linear.weight)))
+            blocks.append(("linear_bias", "float32", self.linear.out_features, 1, self.linear.bias.tolist()))
+
+        write_model_binary(os.path.join(store_dir, store_name), self.cell, recurrent.input_size, hidden_size,
+                           self.linear.out_features, recurrent_rank or 0, blocks)
+
     @torch.jit.ignore
     def store_traced(self, export_dir, export_name, segment_size, device):
         with torch.no_grad():
@@ -20,14 +20,28 @@ LR_STOP = 1e-6
 
 HIDDEN_SIZE = 32
 
+# Recurrent cell, "lstm" or "gru"
+CELL = "lstm"
+
+# Structured pruning: start from the trained HIDDEN_SIZE model, keep only the
+# PRUNED_HIDDEN_SIZE most important hidden units and fine-tune the result
+PRUNED_HIDDEN_SIZE = None
+
+# Export the recurrent weight_hh_l0 as a rank RECURRENT_RANK factorization
+RECURRENT_RANK = None
+
 DATASET_DIR = "dataset"
 MODEL_DIR = "model"
 TEST_DIR = "test"
 
-MODEL_NAME = f"dds19_lstm{HIDDEN_SIZE}"
+BASE_MODEL_NAME = f"dds19_{CELL}{HIDDEN_SIZE}"
+MODEL_NAME = BASE_MODEL_NAME if PRUNED_HIDDEN_SIZE is None else f"{BASE_MODEL_NAME}_pruned{PRUNED_HIDDEN_SIZE}"
 MODEL_CHECKPOINT_NAME = f"{MODEL_NAME}_checkpoint.pt"
 MODEL_TRACED_NAME = f"{MODEL_NAME}_traced.pt"
 MODEL_JSON_NAME = f"{MODEL_NAME}.json"
+MODEL_JSON_INT8_NAME = f"{MODEL_NAME}_int8.json"
+MODEL_BINARY_NAME = f"{MODEL_NAME}.bin"
+MODEL_BINARY_INT8_NAME = f"{MODEL_NAME}_int8.bin"
 
 device = "cuda" if torch.cuda.is_available() else "cpu"
 print(f"Using {device} device")
@@ -41,7 +55,11 @@ train_data, val_data = random_split(dataset, [train_len, val_len])
 train_loader = DataLoader(train_data, batch_size=8, shuffle=True)
 val_loader = DataLoader(val_data, batch_size=8, shuffle=True)
 
-model = DDS19Model(hidden_size=HIDDEN_SIZE).to(device)
+model = DDS19Model(hidden_size=HIDDEN_SIZE, cell=CELL).to(device)
+if PRUNED_HIDDEN_SIZE is not None:
+    model.load_checkpoint(MODEL_DIR, f"{BASE_MODEL_NAME}_checkpoint.pt", device)
+    model = model.prune_hidden_units(PRUNED_HIDDEN_SIZE)
+
 loss_l1 = nn.L1Loss()
 loss_stft = auraloss.freq.STFTLoss(device=device)
 optimiser = optim.Adam(model.parameters(), lr=LR_START)
@@ -62,7 +80,10 @@ for epoch in range(checkpoint_epoch, checkpoint_epoch + EPOCHS):
     if checkpoint_loss > train_loss:
         checkpoint_loss = train_loss
         model.store_checkpoint(MODEL_DIR, MODEL_CHECKPOINT_NAME, optimiser, current_epoch, train_loss, val_loss)
-        model.store_json(MODEL_DIR, MODEL_JSON_NAME)
+        model.store_json(MODEL_DIR, MODEL_JSON_NAME, recurrent_rank=RECURRENT_RANK)
+        model.store_json(MODEL_DIR, MODEL_JSON_INT8_NAME, quantize=True, recurrent_rank=RECURRENT_RANK)
+        model.store_binary(MODEL_DIR, MODEL_BINARY_NAME, recurrent_rank=RECURRENT_RANK)
+        model.store_binary(MODEL_DIR, MODEL_BINARY_INT8_NAME, quantize=True, recurrent_rank=RECURRENT_RANK)
 
     lr = optimiser.param_groups[0]["lr"]
     writer.add_scalar("Epoch Loss/Training", train_loss, current_epoch)
@@ -0,0 +1,132 @@
+#include "AllocationTrap.h"
+
+#if DDS19_ALLOCATION_TRAP
+
+#include <Eigen/Core>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Older Eigen versions keep one flag for the whole process, which would abort
+// on allocations of the model loader thread while the audio thread is trapped
+#if defined(EIGEN_RUNTIME_NO_MALLOC)
+#define DDS19_EIGEN_ALLOCATION_TRAP 1
+#else
+#define DDS19_EIGEN_ALLOCATION_TRAP 0
+#endif
+
+namespace {
+thread_local bool armed { false };
+std::atomic<bool> processWideEigenTrap { false };
+
+void checkAllocation(std::size_t size)
+{
+    if (armed) {
+        armed = false;
+        std::fprintf(stderr, "DDS19: heap allocation of %zu bytes on the audio thread\n", size);
+        std::abort();
+    }
+}
+
+void* allocate(std::size_t size)
+{
+    checkAllocation(size);
+    if (auto* ptr = std::malloc(size != 0 ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void* allocateAligned(std::size_t size, std::align_val_t alignment)
+{
+    checkAllocation(size);
+    const auto align = static_cast<std::size_t>(alignment);
+    const auto alignedSize = (size + align - 1) / align * align;
+#if defined(_MSC_VER)
+    if (auto* ptr = _aligned_malloc(alignedSize != 0 ? alignedSize : align, align))
+#else
+    if (auto* ptr = std::aligned_alloc(align, alignedSize != 0 ? alignedSize : align))
+#endif
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void deallocateAligned(void* ptr)
+{
+#if defined(_MSC_VER)
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+}
+
+ScopedAllocationTrap::ScopedAllocationTrap()
+    : wasArmed(armed)
+    , eigenMallocWasAllowed(true)
+{
+    armed = true;
+#if DDS19_EIGEN_ALLOCATION_TRAP
+    if (trapsEigen()) {
+        eigenMallocWasAllowed = Eigen::internal::is_malloc_allowed();
+        Eigen::internal::set_is_malloc_allowed(false);
+    }
+#endif
+}
+
+ScopedAllocationTrap::~ScopedAllocationTrap()
+{
+#if DDS19_EIGEN_ALLOCATION_TRAP
+    if (trapsEigen())
+        Eigen::internal::set_is_malloc_allowed(eigenMallocWasAllowed);
+#endif
+    armed = wasArmed;
+}
+
+void ScopedAllocationTrap::allowProcessWideEigenTrap()
+{
+    processWideEigenTrap = true;
+}
+
+bool ScopedAllocationTrap::trapsEigen()
+{
+#if DDS19_EIGEN_ALLOCATION_TRAP && EIGEN_VERSION_AT_LEAST(3, 4, 90)
+    return true;
+#elif DDS19_EIGEN_ALLOCATION_TRAP
+    return processWideEigenTrap.load();
+#else
+    return false;
+#endif
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    checkAllocation(size);
+    return std::malloc(size != 0 ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    checkAllocation(size);
+    return std::malloc(size != 0 ? size : 1);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { deallocateAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { deallocateAligned(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { deallocateAligned(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { deallocateAligned(ptr); }
+
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+// Realtime safety check. When the plugin is built with DDS19_ALLOCATION_TRAP,
+// any heap allocation made on the thread that holds a ScopedAllocationTrap
+// aborts with a message, both through the global operator new and through
+// Eigen's allocator (EIGEN_RUNTIME_NO_MALLOC). Other threads, like the model
+// loader, allocate freely meanwhile. Without the option the trap compiles to
+// nothing.
+//
+// Eigen reports through eigen_assert, so the option keeps assertions on, and
+// its flag is only per thread from Eigen 3.4.90 on. With older versions the
+// trap leaves Eigen alone and only checks operator new, unless the caller
+// guarantees that no other thread uses Eigen while a trap is held and calls
+// allowProcessWideEigenTrap(). The option is meant for verification runs, not
+// for release builds.
+class ScopedAllocationTrap {
+public:
+#if DDS19_ALLOCATION_TRAP
+    ScopedAllocationTrap();
+    ~ScopedAllocationTrap();
+
+    static void allowProcessWideEigenTrap();
+
+    // Whether traps also catch Eigen's allocations, which bypass operator new
+    static bool trapsEigen();
+
+private:
+    bool wasArmed;
+    bool eigenMallocWasAllowed;
+#endif
+
+    ScopedAllocationTrap(const ScopedAllocationTrap&) = delete;
+    ScopedAllocationTrap& operator=(const ScopedAllocationTrap&) = delete;
+};
@@ -1,28 +1,49 @@
 #include "DelayLine.h"
 
+#include <algorithm>
 #include <cmath>
 
+void DelayLine::prepare(double sampleRate)
+{
+    const auto maxLagInSamples = static_cast<size_t>(std::ceil(static_cast<double>(maxReadLag_ms) * sampleRate / 1000.0));
+
+    size_t size = ratioGroupSize;
+    while (size < maxLagInSamples + 2)
+        size <<= 1;
+
+    samples.assign(size, 0.0f);
+    sampleRateRatios.assign(size >> ratioShift, 0.0f);
+    mask = size - 1;
+    inputIndex = 0;
+}
+
 void DelayLine::setDelayInSamples(double delayInSamples, float sampleRateRatio)
 {
+    // Reads interpolate between two frames and must stay behind the write index
+    const auto maxDelayInSamples = static_cast<double>(samples.size()) - 2.0;
+
     delayMin = delayInSamples;
-    delayMax = delayInSamples * 8.0;
+    delayMax = std::max(delayMin, std::min(delayInSamples * maxReadReach, maxDelayInSamples));
     outputOffset = delayMin * sampleRateRatio - delayInSamples;
 }
 
 void DelayLine::in(float sample, float inputSampleRateRatio)
 {
-    inputIndex = ++inputIndex % dataBuf.size();
-    dataBuf[inputIndex] = sample;
-    sampleRateRatioBuf[inputIndex] = inputSampleRateRatio;
+    inputIndex = (inputIndex + 1) & mask;
+    samples[inputIndex] = sample;
+    if ((inputIndex & (ratioGroupSize - 1)) == 0)
+        sampleRateRatios[inputIndex >> ratioShift] = inputSampleRateRatio;
 }
 
-float DelayLine::out(float outputSampleRateRatio, float lfo, float depth)
+// modulation is the read speed deviation from the Modulator. pendingWrites
+// is the number of samples that precede this read but have not
+// been written yet, which allows a block of reads to run ahead of its writes
+float DelayLine::out(float outputSampleRateRatio, float modulation, size_t pendingWrites)
 {
-    const auto inputSampleRateRatio = getInputSampleRateRatio();
-    const auto lfoExp = std::pow(4, lfo) - 1.3525266;
+    const auto inputSampleRateRatio = getInputSampleRateRatio(pendingWrites);
 
     const double sampleRateRatio = static_cast<double>(inputSampleRateRatio) / outputSampleRateRatio;
-    auto delta = sampleRateRatio + lfoExp * depth * 0.7;
+    auto delta = sampleRateRatio + static_cast<double>(modulation);
     auto delayDiff = delayMax - delayMin;
 
     outputOffset += 1.0 - delta;
@@ -31,46 +52,48 @@ float DelayLine::out(float outputSampleRateRatio, float lfo, float depth)
     else if (outputOffset > delayDiff)
         outputOffset = delayDiff;
 
-    auto index = getOutputIndex(outputOffset);
+    auto index = getOutputIndex(outputOffset, pendingWrites);
     return readDataAt(index);
 }
 
-double DelayLine::getOutputIndex(double offset)
+// Reads never touch samples newer than the shortest delay, so a block of that
+// many reads can be taken before any of its writes
+bool DelayLine::canReadAhead(size_t numSamples) const
 {
-    const auto maxIndex = static_cast<double>(dataBuf.size());
-    auto index = static_cast<double>(inputIndex) + maxIndex - (delayMin + offset);
-    if (index >= maxIndex)
-        index -= maxIndex;
-
-    return index;
+    return delayMin >= static_cast<double>(numSamples);
 }
 
-float DelayLine::readDataAt(double index)
+// Unwrapped index, readDataAt masks the integer part
+double DelayLine::getOutputIndex(double offset, size_t pendingWrites) const
 {
-    const auto maxIndex = dataBuf.size();
-    const auto preIndex = static_cast<size_t>(index);
-    const auto postIndex = static_cast<size_t>(index + 1.0f);
+    return static_cast<double>(inputIndex + pendingWrites + samples.size()) - (delayMin + offset);
+}
 
-    const auto preSample = dataBuf[preIndex % maxIndex];
-    const auto postSample = dataBuf[postIndex % maxIndex];
+float DelayLine::readDataAt(double index) const
+{
+    const auto wholeIndex = static_cast<size_t>(index);
+    const auto preSample = samples[wholeIndex & mask];
+    const auto postSample = samples[(wholeIndex + 1) & mask];
 
-    const auto remainder = index - static_cast<double>(static_cast<size_t>(index));
+    const auto remainder = index - static_cast<double>(wholeIndex);
     const auto deltaSample = preSample - postSample;
     const auto sample = preSample - deltaSample * static_cast<float>(remainder);
 
     return sample;
 }
 
-float DelayLine::getInputSampleRateRatio()
+// Until the next group has been written, the ratio of its first frame is
+// not known yet and the group's own ratio is used
+float DelayLine::getInputSampleRateRatio(size_t pendingWrites) const
 {
     const auto delay = static_cast<size_t>(delayMin + outputOffset);
-    const auto maxIndex = dataBuf.size();
-
-    size_t index;
-    if (inputIndex >= delay)
-        index = inputIndex - delay;
-    else
-        index = maxIndex - (delay - inputIndex);
-
-    return sampleRateRatioBuf[index];
+    const auto frame = (inputIndex + pendingWrites + samples.size() - delay) & mask;
+    const auto group = frame >> ratioShift;
+    const auto position = frame & (ratioGroupSize - 1);
+    const auto ratio = sampleRateRatios[group];
+    if (position == 0 || delay < pendingWrites + ratioGroupSize - position)
+        return ratio;
+
+    const auto nextRatio = sampleRateRatios[(group + 1) & (sampleRateRatios.size() - 1)];
+    return ratio + (nextRatio - ratio) * static_cast<float>(position) / static_cast<float>(ratioGroupSize);
 }
@@ -1,23 +1,38 @@
 #pragma once
 
-#include <array>
+#include <cstddef>
+#include <vector>
 
 class DelayLine {
 public:
+    void prepare(double sampleRate);
     void setDelayInSamples(double delayInSamples, float sampleRateRatio);
     void in(float sample, float inputSampleRateRatio);
-    float out(float outputSampleRateRatio, float lfo, float depth);
+    float out(float outputSampleRateRatio, float modulation, size_t pendingWrites = 0);
+    bool canReadAhead(size_t numSamples) const;
 
 private:
-    double getOutputIndex(double offset);
-    float readDataAt(double index);
-    float getInputSampleRateRatio();
+    double getOutputIndex(double offset, size_t pendingWrites) const;
+    float readDataAt(double index) const;
+    float getInputSampleRateRatio(size_t pendingWrites) const;
 
-    static constexpr size_t maxDelay_ms { 8192 };
-    static constexpr size_t maxSampleRate_kHz { 192 };
+    // Slowed down reads (S/F, FINE and modulation) lag the write index by up
+    // to maxReadReach times the delay, capped by the buffer, which holds at
+    // least maxReadLag_ms. COARSE up to 2048 ms keeps the full reach, 4096 ms
+    // and 8192 ms stop at the cap.
+    static constexpr double maxReadReach { 8.0 };
+    static constexpr size_t maxReadLag_ms { 16384 };
 
-    std::array<float, maxDelay_ms * maxSampleRate_kHz> dataBuf {};
-    std::array<float, maxDelay_ms * maxSampleRate_kHz> sampleRateRatioBuf {};
+    // The sample rate ratio only moves with the linear S/F and FINE ramps, so
+    // it is kept for the first frame of every group of 2^ratioShift frames and
+    // interpolated in between
+    static constexpr size_t ratioShift { 5 };
+    static constexpr size_t ratioGroupSize { size_t { 1 } << ratioShift };
+
+    // Power of two lengths, indices wrap with mask
+    std::vector<float> samples;
+    std::vector<float> sampleRateRatios;
+    size_t mask { 0 };
 
     size_t inputIndex { 0 };
     double outputOffset { 0.0 };
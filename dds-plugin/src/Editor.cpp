@@ -1,7 +1,10 @@
 #include "Editor.h"
 
+#include <fmt/core.h>
+
 Editor::Editor(Processor& p)
     : juce::AudioProcessorEditor(p)
+    , loadMonitor(p.getLoadMonitor())
     , mixAttachment(p.getState(), "mix", mix)
     , regenAttachment(p.getState(), "regen", regen)
     , coarseAttachment(p.getState(), "coarse", coarse)
@@ -18,7 +21,7 @@ Editor::Editor(Processor& p)
     juce::ignoreUnused(depthAttachment);
     juce::ignoreUnused(sfAttachment);
 
-    setSize(700, 130);
+    setSize(700, 130 + statusHeight);
 
     addAndMakeVisible(mix);
     mix.setSliderStyle(Slider::Rotary);
@@ -106,6 +109,16 @@ Editor::Editor(Processor& p)
     addAndMakeVisible(fineRightLabel);
     addAndMakeVisible(rateRightLabel);
     addAndMakeVisible(depthRightLabel);
+
+    loadButton.setClickingTogglesState(true);
+    loadButton.setColour(Button::ColourIds::buttonOnColourId, juce::Colours::crimson);
+    loadButton.onClick = [this] { setLoadOverlayVisible(loadButton.getToggleState()); };
+    loadResetButton.onClick = [this] { loadMonitor.requestReset(); };
+    loadLabel.setFont(labelDetailsFont);
+    loadLabel.setJustificationType(juce::Justification::centredRight);
+    addAndMakeVisible(loadButton);
+    addChildComponent(loadResetButton);
+    addChildComponent(loadLabel);
 }
 
 void Editor::paint(juce::Graphics& g)
@@ -116,7 +129,15 @@ void Editor::paint(juce::Graphics& g)
 
 void Editor::resized()
 {
-    auto area = getLocalBounds().reduced(8);
+    auto bounds = getLocalBounds();
+    auto statusArea = bounds.removeFromBottom(statusHeight).withTrimmedBottom(4).reduced(8, 0);
+    loadButton.setBounds(statusArea.removeFromRight(40));
+    statusArea.removeFromRight(4);
+    loadResetButton.setBounds(statusArea.removeFromRight(50));
+    statusArea.removeFromRight(4);
+    loadLabel.setBounds(statusArea);
+
+    auto area = bounds.reduced(8);
     auto itemWidth = area.getWidth() / 7;
     auto spacing = itemWidth / 6;
     auto labelHeight = 15;
@@ -196,3 +217,23 @@ void Editor::resized()
     rateRightLabel.setBounds(rateRightArea);
     depthRightLabel.setBounds(depthRightArea);
 }
+
+void Editor::timerCallback()
+{
+    auto snapshot = loadMonitor.getSnapshot();
+    loadLabel.setText(fmt::format("LOAD P50 {:.0f}%  P99 {:.0f}%  MAX {:.0f}%  OVERRUNS {} / {} BLOCKS",
+                          snapshot.p50 * 100.0, snapshot.p99 * 100.0, snapshot.max * 100.0, snapshot.numOverruns, snapshot.numBlocks),
+        juce::dontSendNotification);
+}
+
+void Editor::setLoadOverlayVisible(bool visible)
+{
+    loadLabel.setVisible(visible);
+    loadResetButton.setVisible(visible);
+    if (visible) {
+        timerCallback();
+        startTimerHz(loadPollRate_Hz);
+    } else {
+        stopTimer();
+    }
+}
@@ -4,13 +4,20 @@
 
 #include <juce_audio_processors/juce_audio_processors.h>
 
-class Editor : public juce::AudioProcessorEditor {
+class Editor : public juce::AudioProcessorEditor,
+               private juce::Timer {
 public:
     explicit Editor(Processor& p);
     void paint(juce::Graphics& g) override;
     void resized() override;
 
 private:
+    static constexpr int statusHeight { 18 };
+    static constexpr int loadPollRate_Hz { 4 };
+
+    void timerCallback() override;
+    void setLoadOverlayVisible(bool visible);
+
     using Slider = juce::Slider;
     using Button = juce::TextButton;
     using Label = juce::Label;
@@ -24,6 +31,8 @@ private:
     Slider rate;
     Slider depth;
     Button sf {"S/F"};
+    Button loadButton { "CPU" };
+    Button loadResetButton { "RESET" };
 
     Label mixLabel { {}, "MIX" };
     Label regenLabel { {}, "REGEN" };
@@ -46,6 +55,10 @@ private:
     Label rateRightLabel { {}, "FAST" };
     Label depthRightLabel { {}, "MAX" };
 
+    // Optional processing load overlay, polled from the message thread
+    LoadMonitor& loadMonitor;
+    Label loadLabel;
+
     SliderAttachment mixAttachment;
     SliderAttachment regenAttachment;
     SliderAttachment coarseAttachment;
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "RecurrentCell.h"
+
+// Single layer GRU followed by a linear layer. Three gates (reset, update, new)
+// instead of four and no cell state, so a step costs about a quarter less than
+// an LSTM of the same hidden size. The new gate sees its recurrent product
+// scaled by the reset gate, so the recurrent products are kept apart from the
+// input projections until the activations.
+template <int HiddenSize>
+class Gru final : public RecurrentCell<Gru<HiddenSize>, HiddenSize, 3> {
+    using Base = RecurrentCell<Gru<HiddenSize>, HiddenSize, 3>;
+    friend Base;
+
+public:
+    explicit Gru(const RecurrentWeights& weights)
+        : Base(weights)
+    {
+        recurrentBias.setZero(weights.gateSize);
+        recurrentBias.tail(weights.hiddenSize) = HiddenBias(weights.recurrentBias, weights.hiddenSize);
+        this->prepare(Base::maxProjectionColumns, 1);
+    }
+
+private:
+    static constexpr int sigmoidSize { HiddenSize == Eigen::Dynamic ? Eigen::Dynamic : 2 * HiddenSize };
+
+    using typename Base::GateState;
+    using typename Base::GateVector;
+    using HiddenBias = Eigen::Map<const Eigen::Matrix<float, HiddenSize, 1>, Eigen::Aligned16>;
+    using Base::gate;
+    using Base::gates;
+    using Base::h_t;
+    using Base::recurrent;
+    using Base::sigmoidGate;
+
+    void prepareState(int numChannels)
+    {
+        recurrentGates.setZero(gates.rows(), numChannels);
+    }
+
+    void addRecurrent()
+    {
+        recurrentGates.colwise() = recurrentBias;
+        recurrent.addTo(recurrentGates, h_t);
+    }
+
+    // n = tanh(x_n + r * (W_hn h + b_hn)), h = n + z * (h - n)
+    template <ActivationMode Mode>
+    void activate()
+    {
+        auto sigmoidGates = gates.template topRows<sigmoidSize>(2 * h_t.rows()).array();
+        sigmoidGates += recurrentGates.template topRows<sigmoidSize>(2 * h_t.rows()).array();
+        Activation<Mode>::tanh(sigmoidGates, sigmoidGates);
+        gate(2) += sigmoidGate(0) * recurrentGate(2);
+        Activation<Mode>::tanh(gate(2), gate(2));
+        h_t.array() = gate(2) + sigmoidGate(1) * (h_t.array() - gate(2));
+    }
+
+    auto recurrentGate(Eigen::Index index)
+    {
+        return recurrentGates.template middleRows<HiddenSize>(index * h_t.rows(), h_t.rows()).array();
+    }
+
+    // Zero except for the new gate's recurrent bias, which the reset gate scales
+    GateVector recurrentBias;
+    GateState recurrentGates;
+};
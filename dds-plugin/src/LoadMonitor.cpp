@@ -0,0 +1,72 @@
+#include "LoadMonitor.h"
+
+#include <algorithm>
+
+void LoadMonitor::record(double load)
+{
+    if (resetRequested.exchange(false, std::memory_order_acquire))
+        reset();
+
+    auto bin = std::clamp(static_cast<int>(load / binWidth), 0, numBins - 1);
+    bins[static_cast<size_t>(bin)].fetch_add(1, std::memory_order_relaxed);
+    if (load > 1.0)
+        numOverruns.fetch_add(1, std::memory_order_relaxed);
+    if (load > maxLoad.load(std::memory_order_relaxed))
+        maxLoad.store(load, std::memory_order_relaxed);
+
+    // Published last, so a reader never sees more blocks than bin counts
+    numBlocks.fetch_add(1, std::memory_order_release);
+}
+
+void LoadMonitor::reset()
+{
+    numBlocks.store(0, std::memory_order_relaxed);
+    for (auto& bin : bins)
+        bin.store(0, std::memory_order_relaxed);
+    numOverruns.store(0, std::memory_order_relaxed);
+    maxLoad.store(0.0, std::memory_order_relaxed);
+}
+
+void LoadMonitor::requestReset()
+{
+    resetRequested.store(true, std::memory_order_release);
+}
+
+// The counters keep moving while they are read, so the snapshot is only
+// approximately consistent, which is plenty for a display
+LoadMonitor::Snapshot LoadMonitor::getSnapshot() const
+{
+    Snapshot snapshot;
+    snapshot.numBlocks = numBlocks.load(std::memory_order_acquire);
+
+    std::array<std::uint64_t, numBins> counts;
+    std::uint64_t total { 0 };
+    for (size_t i = 0; i < counts.size(); i++) {
+        counts[i] = bins[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    snapshot.numOverruns = numOverruns.load(std::memory_order_relaxed);
+    snapshot.max = maxLoad.load(std::memory_order_relaxed);
+    snapshot.p50 = getPercentile(counts, total, 0.5);
+    snapshot.p99 = getPercentile(counts, total, 0.99);
+    return snapshot;
+}
+
+// Upper edge of the bin holding the given fraction of blocks, so the result
+// errs on the side of a higher load
+double LoadMonitor::getPercentile(const std::array<std::uint64_t, numBins>& counts, std::uint64_t total, double fraction) const
+{
+    if (total == 0)
+        return 0.0;
+
+    auto target = static_cast<std::uint64_t>(fraction * static_cast<double>(total - 1)) + 1;
+    std::uint64_t count { 0 };
+    for (auto bin = 0; bin < numBins; bin++) {
+        count += counts[static_cast<size_t>(bin)];
+        if (count >= target)
+            return (bin + 1) * binWidth;
+    }
+
+    return numBins * binWidth;
+}
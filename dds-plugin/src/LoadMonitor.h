@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Histogram of the per-block processing load, the time spent in processBlock
+// relative to the duration of the block. The audio thread records with relaxed
+// atomic increments only, readers take snapshots at any time without blocking
+// it. A load above 1.0 missed the block deadline.
+//
+// Only the audio thread writes the counters, a reset from another thread is
+// requested and carried out on the next recorded block.
+class LoadMonitor {
+public:
+    struct Snapshot {
+        std::uint64_t numBlocks { 0 };
+        std::uint64_t numOverruns { 0 };
+        double p50 { 0.0 };
+        double p99 { 0.0 };
+        double max { 0.0 };
+    };
+
+    // Audio thread, or while it is stopped
+    void record(double load);
+    void reset();
+
+    // Any thread
+    void requestReset();
+    Snapshot getSnapshot() const;
+
+private:
+    // 1% wide bins up to 255%, the last bin collects everything above
+    static constexpr int numBins { 256 };
+    static constexpr double binWidth { 0.01 };
+
+    double getPercentile(const std::array<std::uint64_t, numBins>& counts, std::uint64_t total, double fraction) const;
+
+    std::array<std::atomic<std::uint64_t>, numBins> bins {};
+    std::atomic<std::uint64_t> numBlocks { 0 };
+    std::atomic<std::uint64_t> numOverruns { 0 };
+    std::atomic<double> maxLoad { 0.0 };
+    std::atomic<bool> resetRequested { false };
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "RecurrentCell.h"
+
+// Single layer LSTM followed by a linear layer: four gates (input, forget,
+// cell, output) and a cell state next to h_t.
+template <int HiddenSize>
+class Lstm final : public RecurrentCell<Lstm<HiddenSize>, HiddenSize, 4> {
+    using Base = RecurrentCell<Lstm<HiddenSize>, HiddenSize, 4>;
+    friend Base;
+
+public:
+    explicit Lstm(const RecurrentWeights& weights)
+        : Base(weights)
+    {
+        this->prepare(Base::maxProjectionColumns, 1);
+    }
+
+private:
+    using typename Base::HiddenState;
+    using Base::gate;
+    using Base::gates;
+    using Base::h_t;
+    using Base::recurrent;
+    using Base::sigmoidGate;
+
+    void prepareState(int numChannels)
+    {
+        c_t.setZero(h_t.rows(), numChannels);
+    }
+
+    void addRecurrent()
+    {
+        recurrent.addTo(gates, h_t);
+    }
+
+    template <ActivationMode Mode>
+    void activate()
+    {
+        Activation<Mode>::tanh(gates.array(), gates.array());
+        c_t.array() = sigmoidGate(1) * c_t.array() + sigmoidGate(0) * gate(2);
+        Activation<Mode>::tanh(c_t.array(), h_t.array());
+        h_t.array() *= sigmoidGate(3);
+    }
+
+    HiddenState c_t;
+};
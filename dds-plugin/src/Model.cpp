@@ -1,79 +1,101 @@
 #include "Model.h"
-#include "BinaryData.h"
+#include "Gru.h"
+#include "Lstm.h"
+#include "ModelData.h"
+#include "ModelFile.h"
+#include "Profiler.h"
 
-#include <nlohmann/json.hpp>
-#include <sstream>
+#include <stdexcept>
+#include <utility>
 
-Model::Model()
+namespace {
+template <template <int> class Cell>
+std::unique_ptr<RecurrentEngine> createCell(const RecurrentWeights& weights)
 {
-    // Load json model
-    nlohmann::json model_json;
-    std::istringstream(BinaryData::dds19_lstm32_json) >> model_json;
-
-    // Load model parameters
-    lstmWeight_ih = stdToEigen(model_json["/lstm.weight_ih_l0"_json_pointer].get<StdMatrix>());
-    lstmWeight_hh = stdToEigen(model_json["/lstm.weight_hh_l0"_json_pointer].get<StdMatrix>());
-    lstmBias_ih = stdToEigen(model_json["/lstm.bias_ih_l0"_json_pointer].get<StdVector>());
-    lstmBias_hh = stdToEigen(model_json["/lstm.bias_hh_l0"_json_pointer].get<StdVector>());
-    linearWeight = stdToEigen(model_json["/linear.weight"_json_pointer].get<StdMatrix>());
-    linearBias = stdToEigen(model_json["/linear.bias"_json_pointer].get<StdVector>());
-
-    // Get model sizes
-    inputSize = lstmWeight_ih.cols();
-    outputSize = linearWeight.cols();
-    gateSize = lstmWeight_ih.rows();
-    hiddenSize = gateSize / 4;
+    switch (weights.hiddenSize) {
+    case 32:
+        return std::make_unique<Cell<32>>(weights);
+    case 64:
+        return std::make_unique<Cell<64>>(weights);
+    case 96:
+        return std::make_unique<Cell<96>>(weights);
+    default:
+        return std::make_unique<Cell<Eigen::Dynamic>>(weights);
+    }
+}
+}
 
-    // Initialise
-    input = EigVector(inputSize).setZero();
-    output = EigVector(outputSize).setZero();
-    gates = EigVector(gateSize).setZero();
-    c_t = EigVector(hiddenSize).setZero();
-    h_t = EigVector(hiddenSize).setZero();
+Model::Model(const std::string& name)
+    : weights(findWeights(name))
+    , engine(createEngine(weights))
+{
 }
 
-float Model::process(float sample, float sf, float delayFine)
+Model::Model(std::shared_ptr<const ModelFile> modelFile)
+    : file(std::move(modelFile))
+    , weights(file->getWeights())
+    , engine(createEngine(weights))
 {
-    // Input
-    input[0] = sample;
-    input[1] = sf;
-    input[2] = delayFine;
+}
 
-    // LSTM
-    gates = input * lstmWeight_ih.transpose() + lstmBias_ih + h_t * lstmWeight_hh.transpose() + lstmBias_hh;
-    for (auto i = 0; i < hiddenSize; i++) {
-        c_t[i] = sigmoid(gates[hiddenSize + i]) * c_t[i] + sigmoid(gates[i]) * tanhf(gates[2 * hiddenSize + i]);
-        h_t[i] = sigmoid(gates[3 * hiddenSize + i]) * tanhf(c_t[i]);
+RecurrentWeights Model::findWeights(const std::string& name)
+{
+    for (const auto& model : ModelData::models) {
+        if (name == model.name) {
+            RecurrentWeights weights;
+            weights.cellType = std::string(model.cell) == "gru" ? CellType::gru : CellType::lstm;
+            weights.weightIh = model.weightIh;
+            weights.weightHh = model.weightHh;
+            weights.weightHhInt8 = model.weightHhInt8;
+            weights.weightHhScale = model.weightHhScale;
+            weights.weightHhU = model.weightHhU;
+            weights.weightHhV = model.weightHhV;
+            weights.recurrentRank = model.recurrentRank;
+            weights.bias = model.bias;
+            weights.recurrentBias = model.recurrentBias;
+            weights.linearWeight = model.linearWeight;
+            weights.linearBias = model.linearBias;
+            weights.inputSize = model.inputSize;
+            weights.hiddenSize = model.hiddenSize;
+            weights.gateSize = model.gateSize;
+            weights.outputSize = model.outputSize;
+            return weights;
+        }
     }
 
-    // Linear
-    output = h_t * linearWeight.transpose() + linearBias;
-    return output.value();
+    throw std::invalid_argument("Unknown model " + name);
+}
+
+void Model::prepare(int maximumBlockSize, int numChannels)
+{
+    engine->prepare(maximumBlockSize, numChannels);
 }
 
-Model::EigMatrix Model::stdToEigen(const Model::StdMatrix& values)
+void Model::setConditioning(float sf, float delayFine)
 {
-    auto rows = values.size();
-    auto cols = values[0].size();
-    auto mat = EigMatrix(rows, cols);
-    for (size_t row = 0; row < rows; row++)
-        for (size_t col = 0; col < cols; col++)
-            mat(static_cast<EigIndex>(row), static_cast<EigIndex>(col)) = values[row][col];
+    if (sf == conditioningSf && delayFine == conditioningDelayFine)
+        return;
 
-    return mat;
+    conditioningSf = sf;
+    conditioningDelayFine = delayFine;
+    engine->setConditioning(sf, delayFine);
 }
 
-Model::EigVector Model::stdToEigen(const Model::StdVector& values)
+void Model::process(const float* input, float* output, int numFrames)
 {
-    auto rows = values.size();
-    auto vec = EigVector(rows);
-    for (size_t row = 0; row < rows; row++)
-        vec(static_cast<EigIndex>(row)) = values[row];
+    DDS19_PROFILE_ZONE("model");
+    engine->process(input, output, numFrames);
+}
 
-    return vec;
+void Model::setActivationMode(ActivationMode mode)
+{
+    engine->setActivationMode(mode);
 }
 
-float Model::sigmoid(float x)
+std::unique_ptr<RecurrentEngine> Model::createEngine(const RecurrentWeights& weights)
 {
-    return 1.0f / (1.0f + expf(-x));
+    if (weights.cellType == CellType::gru)
+        return createCell<Gru>(weights);
+
+    return createCell<Lstm>(weights);
 }
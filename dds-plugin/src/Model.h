@@ -1,40 +1,39 @@
 #pragma once
 
-#include <Eigen/Dense>
+#include "RecurrentEngine.h"
+
+#include <memory>
 #include <string>
-#include <vector>
+
+class ModelFile;
 
 class Model {
 public:
-    explicit Model();
-    float process(float sample, float sf, float delayFine);
+    explicit Model(const std::string& name = "dds19_lstm32");
+
+    // Runs the weights of a binary model file, which the model keeps alive
+    explicit Model(std::shared_ptr<const ModelFile> modelFile);
+
+    void prepare(int maximumBlockSize, int numChannels);
+    void setConditioning(float sf, float delayFine);
+    void process(const float* input, float* output, int numFrames);
+    void setActivationMode(ActivationMode mode);
 
 private:
-    using EigMatrix = Eigen::MatrixXf;
-    using EigVector = Eigen::RowVectorXf;
-    using EigIndex = Eigen::Index;
-    using StdMatrix = std::vector<std::vector<float>>;
-    using StdVector = std::vector<float>;
-
-    static EigMatrix stdToEigen(const StdMatrix& values);
-    static EigVector stdToEigen(const StdVector& values);
-    static float sigmoid(float x);
-
-    EigMatrix lstmWeight_ih;
-    EigMatrix lstmWeight_hh;
-    EigVector lstmBias_ih;
-    EigVector lstmBias_hh;
-    EigMatrix linearWeight;
-    EigVector linearBias;
-
-    EigIndex inputSize;
-    EigIndex outputSize;
-    EigIndex gateSize;
-    EigIndex hiddenSize;
-
-    EigVector input;
-    EigVector output;
-    EigVector gates;
-    EigVector c_t;
-    EigVector h_t;
+    static RecurrentWeights findWeights(const std::string& name);
+    static std::unique_ptr<RecurrentEngine> createEngine(const RecurrentWeights& weights);
+
+    // Set for models loaded from a file, shared by every model running it
+    std::shared_ptr<const ModelFile> file;
+
+    // Views the compiled-in weights or the mapped file, the engine maps them
+    // in place and only owns the per-instance state
+    RecurrentWeights weights;
+    std::unique_ptr<RecurrentEngine> engine;
+
+    float conditioningSf { 0.0f };
+    float conditioningDelayFine { 0.0f };
+
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
 };
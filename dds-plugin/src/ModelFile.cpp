@@ -0,0 +1,110 @@
+#include "ModelFile.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+// Layout documented with write_model_binary in dds-nn/model.py
+constexpr char magic[8] { 'D', 'D', 'S', '1', '9', 'M', 'D', 'L' };
+constexpr std::uint32_t version { 1 };
+constexpr std::size_t headerSize { 64 };
+constexpr std::size_t entrySize { 64 };
+constexpr std::size_t nameSize { 32 };
+constexpr std::uint32_t float32Block { 0 };
+constexpr std::uint32_t int8Block { 1 };
+
+template <typename Value>
+Value read(const char* data, std::size_t offset)
+{
+    Value value;
+    std::memcpy(&value, data + offset, sizeof(value));
+    return value;
+}
+}
+
+ModelFile::ModelFile(const std::string& filePath)
+    : path(filePath)
+{
+    const auto file = juce::File::getCurrentWorkingDirectory().getChildFile(juce::String(path));
+    mappedFile = std::make_unique<juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+    if (mappedFile->getData() == nullptr)
+        throw std::runtime_error("Cannot map " + path);
+
+    const auto* data = static_cast<const char*>(mappedFile->getData());
+    if (mappedFile->getSize() < headerSize || std::memcmp(data, magic, sizeof(magic)) != 0)
+        throw std::runtime_error(path + " is not a binary model");
+    if (read<std::uint32_t>(data, 8) != version)
+        throw std::runtime_error(path + " has an unsupported model version");
+
+    const auto cell = read<std::uint32_t>(data, 12);
+    if (cell > 1)
+        throw std::runtime_error(path + " has an unknown cell type");
+
+    weights.cellType = cell == 1 ? CellType::gru : CellType::lstm;
+    weights.inputSize = read<std::uint32_t>(data, 16);
+    weights.hiddenSize = read<std::uint32_t>(data, 20);
+    weights.gateSize = read<std::uint32_t>(data, 24);
+    weights.outputSize = read<std::uint32_t>(data, 28);
+    weights.recurrentRank = read<std::uint32_t>(data, 32);
+    numBlocks = read<std::uint32_t>(data, 36);
+    if (weights.gateSize != (weights.cellType == CellType::gru ? 3 : 4) * weights.hiddenSize)
+        throw std::runtime_error(path + " has an inconsistent gate size");
+    // The engines take the sample and two conditioning inputs and have one output
+    if (weights.inputSize != 3 || weights.outputSize != 1)
+        throw std::runtime_error(path + " needs 3 inputs and 1 output");
+    if (mappedFile->getSize() < headerSize + numBlocks * entrySize)
+        throw std::runtime_error(path + " is truncated");
+
+    const auto inputSize = weights.inputSize;
+    const auto hiddenSize = weights.hiddenSize;
+    const auto gateSize = weights.gateSize;
+    const auto outputSize = weights.outputSize;
+    const auto rank = weights.recurrentRank;
+    weights.weightIh = static_cast<const float*>(findBlock("weight_ih", float32Block, gateSize, inputSize));
+    weights.bias = static_cast<const float*>(findBlock("bias", float32Block, gateSize, 1));
+    weights.linearWeight = static_cast<const float*>(findBlock("linear_weight", float32Block, outputSize, hiddenSize));
+    weights.linearBias = static_cast<const float*>(findBlock("linear_bias", float32Block, outputSize, 1));
+    if (weights.cellType == CellType::gru)
+        weights.recurrentBias = static_cast<const float*>(findBlock("recurrent_bias", float32Block, hiddenSize, 1));
+
+    // Exactly one form of the recurrent weights, the same choice as ModelData
+    if (rank > 0) {
+        weights.weightHhU = static_cast<const float*>(findBlock("weight_hh_u", float32Block, gateSize, rank));
+        weights.weightHhV = static_cast<const float*>(findBlock("weight_hh_v", float32Block, rank, hiddenSize));
+    } else {
+        weights.weightHh = static_cast<const float*>(findBlock("weight_hh", float32Block, gateSize, hiddenSize, false));
+        if (weights.weightHh == nullptr) {
+            weights.weightHhInt8 = static_cast<const std::int8_t*>(findBlock("weight_hh_int8", int8Block, gateSize, hiddenSize));
+            weights.weightHhScale = static_cast<const float*>(findBlock("weight_hh_scale", float32Block, gateSize, 1));
+        }
+    }
+}
+
+const void* ModelFile::findBlock(const char* name, std::uint32_t type, Eigen::Index rows, Eigen::Index cols, bool required) const
+{
+    const auto* data = static_cast<const char*>(mappedFile->getData());
+    for (std::size_t i = 0; i < numBlocks; i++) {
+        const auto entry = headerSize + i * entrySize;
+        if (std::strncmp(data + entry, name, nameSize) != 0)
+            continue;
+
+        const auto elementSize = type == int8Block ? sizeof(std::int8_t) : sizeof(float);
+        const auto offset = read<std::uint64_t>(data, entry + 48);
+        const auto size = read<std::uint64_t>(data, entry + 56);
+        const auto valid = read<std::uint32_t>(data, entry + 32) == type
+            && read<std::uint32_t>(data, entry + 36) == rows
+            && read<std::uint32_t>(data, entry + 40) == cols
+            && size == static_cast<std::uint64_t>(rows * cols) * elementSize
+            && offset % 16 == 0
+            && offset + size <= mappedFile->getSize();
+        if (!valid)
+            throw std::runtime_error(path + ": block " + name + " does not match the model");
+
+        // The engines map the blocks with Eigen::Aligned16
+        return data + offset;
+    }
+
+    if (required)
+        throw std::runtime_error(path + ": missing block " + name);
+    return nullptr;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "RecurrentEngine.h"
+
+#include <juce_core/juce_core.h>
+
+#include <memory>
+#include <string>
+
+// Binary model written by store_binary in dds-nn/model.py, mapped read-only.
+// The file holds the weights in the RecurrentWeights layout already, so
+// loading only checks the header and block table and points the weights into
+// the mapping: no parsing and no copies, and the pages are shared with every
+// other instance mapping the same file.
+//
+// Keep the ModelFile alive for as long as any engine uses its weights.
+class ModelFile {
+public:
+    // Throws std::runtime_error when the file cannot be mapped or does not
+    // hold a complete model
+    explicit ModelFile(const std::string& path);
+
+    const RecurrentWeights& getWeights() const { return weights; }
+
+private:
+    const void* findBlock(const char* name, std::uint32_t type, Eigen::Index rows, Eigen::Index cols, bool required = true) const;
+
+    std::string path;
+    std::unique_ptr<juce::MemoryMappedFile> mappedFile;
+    std::uint32_t numBlocks { 0 };
+    RecurrentWeights weights;
+
+    ModelFile(const ModelFile&) = delete;
+    ModelFile& operator=(const ModelFile&) = delete;
+};
@@ -0,0 +1,194 @@
+#include "ModelSwitcher.h"
+
+#include <algorithm>
+
+namespace {
+// Indexed by quality, smallest first
+constexpr const char* modelNames[ModelSwitcher::numQualities] { "dds19_lstm32", "dds19_lstm64", "dds19_lstm96" };
+}
+
+ModelSwitcher::ModelSwitcher()
+    : juce::Thread("DDS19 model loader")
+{
+}
+
+ModelSwitcher::~ModelSwitcher()
+{
+    stopThread(1000);
+    delete incoming.exchange(nullptr);
+    delete outgoing.exchange(nullptr);
+}
+
+void ModelSwitcher::prepare(double newSampleRate, int newMaximumBlockSize, int newNumChannels)
+{
+    stopThread(1000);
+    delete incoming.exchange(nullptr);
+    delete outgoing.exchange(nullptr);
+
+    maximumBlockSize = newMaximumBlockSize;
+    numChannels = newNumChannels;
+    sampleRate = newSampleRate;
+    setResamplingFactor(1);
+    crossfadePosition = 0;
+    previousOutput.assign(static_cast<size_t>(maximumBlockSize * numChannels), 0.0f);
+    smoothedLoad = 0.0;
+
+    auto quality = getTargetQuality();
+    previous.reset();
+    current = createModel(quality);
+    current->setConditioning(conditioningSf, conditioningDelayFine);
+    loadedQuality = quality;
+
+    startThread();
+}
+
+void ModelSwitcher::setQuality(int quality)
+{
+    requestedQuality = std::clamp(quality, 0, numQualities - 1);
+    qualityCap = numQualities - 1;
+    notify();
+}
+
+void ModelSwitcher::setGovernorEnabled(bool enabled)
+{
+    governorEnabled = enabled;
+    qualityCap = numQualities - 1;
+    notify();
+}
+
+void ModelSwitcher::setActivationMode(ActivationMode mode)
+{
+    activationMode = mode;
+}
+
+void ModelSwitcher::setNonRealtime(bool isNonRealtime)
+{
+    nonRealtime = isNonRealtime;
+    qualityCap = numQualities - 1;
+    notify();
+}
+
+// Only while non-realtime, before the block is processed. The new model is
+// adopted by the process() call that follows, or once a running crossfade
+// has finished, so a render switches at the same sample every time.
+void ModelSwitcher::loadSynchronously()
+{
+    delete outgoing.exchange(nullptr);
+
+    auto quality = getTargetQuality();
+    if (quality != loadedQuality) {
+        delete incoming.exchange(createModel(quality).release());
+        loadedQuality = quality;
+    }
+}
+
+// With the resampler active the models run at sampleRate / factor, so the
+// crossfade counts native frames and is shortened to last as long
+void ModelSwitcher::setResamplingFactor(int factor)
+{
+    crossfadeLength = std::max(1, static_cast<int>(crossfadeTime_s * sampleRate / factor));
+    crossfadePosition = std::min(crossfadePosition, crossfadeLength);
+}
+
+void ModelSwitcher::setConditioning(float sf, float delayFine)
+{
+    conditioningSf = sf;
+    conditioningDelayFine = delayFine;
+    current->setConditioning(sf, delayFine);
+    if (previous != nullptr)
+        previous->setConditioning(sf, delayFine);
+}
+
+void ModelSwitcher::process(const float* input, float* output, int numFrames)
+{
+    adoptIncoming();
+
+    auto mode = activationMode.load(std::memory_order_relaxed);
+    current->setActivationMode(mode);
+
+    // The old model runs first so that input and output may alias
+    if (previous != nullptr) {
+        previous->setActivationMode(mode);
+        previous->process(input, previousOutput.data(), numFrames);
+    }
+
+    current->process(input, output, numFrames);
+
+    if (previous != nullptr)
+        crossfade(output, numFrames);
+}
+
+void ModelSwitcher::reportLoad(double load)
+{
+    smoothedLoad += loadSmoothing * (load - smoothedLoad);
+
+    // Only judge a settled model, a crossfade runs two of them
+    auto quality = getTargetQuality();
+    if (!governorEnabled || nonRealtime || previous != nullptr || incoming.load() != nullptr || loadedQuality != quality)
+        return;
+
+    if (smoothedLoad > governorThreshold && quality > 0) {
+        qualityCap = quality - 1;
+        smoothedLoad = 0.0;
+    }
+}
+
+void ModelSwitcher::run()
+{
+    while (!threadShouldExit()) {
+        delete outgoing.exchange(nullptr);
+
+        auto quality = getTargetQuality();
+        if (!nonRealtime && quality != loadedQuality) {
+            // Replaces a model the audio thread has not picked up yet
+            delete incoming.exchange(createModel(quality).release());
+            loadedQuality = quality;
+        }
+
+        wait(pollInterval_ms);
+    }
+}
+
+int ModelSwitcher::getTargetQuality() const
+{
+    return governorEnabled && !nonRealtime ? std::min(requestedQuality.load(), qualityCap.load()) : requestedQuality.load();
+}
+
+std::unique_ptr<Model> ModelSwitcher::createModel(int quality) const
+{
+    auto model = std::make_unique<Model>(modelNames[quality]);
+    model->prepare(maximumBlockSize, numChannels);
+    model->setActivationMode(activationMode);
+    return model;
+}
+
+// A new model is only taken once the previous crossfade has finished and its
+// model has been collected, so the audio thread never has to free anything
+void ModelSwitcher::adoptIncoming()
+{
+    if (previous != nullptr || outgoing.load() != nullptr)
+        return;
+
+    if (auto* next = incoming.exchange(nullptr)) {
+        previous = std::move(current);
+        current.reset(next);
+        current->setConditioning(conditioningSf, conditioningDelayFine);
+        crossfadePosition = 0;
+    }
+}
+
+void ModelSwitcher::crossfade(float* output, int numFrames)
+{
+    auto frames = std::min(numFrames, crossfadeLength - crossfadePosition);
+    for (auto frame = 0; frame < frames; frame++) {
+        auto gain = static_cast<float>(crossfadePosition + frame + 1) / static_cast<float>(crossfadeLength);
+        for (auto channel = 0; channel < numChannels; channel++) {
+            auto index = static_cast<size_t>(frame * numChannels + channel);
+            output[index] = previousOutput[index] + gain * (output[index] - previousOutput[index]);
+        }
+    }
+
+    crossfadePosition += frames;
+    if (crossfadePosition >= crossfadeLength)
+        outgoing = previous.release();
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Model.h"
+
+#include <juce_core/juce_core.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Owns the running Model and switches between the shipped model sizes without
+// blocking the audio thread. Models are built on a background thread and handed
+// over through an atomic pointer, the audio thread crossfades from the old to
+// the new one and hands the old one back for deletion the same way.
+//
+// The optional governor steps down to the next smaller model when processing
+// takes too large a share of the block deadline. It never steps back up on its
+// own, a new quality choice resets it.
+//
+// Offline rendering has no deadline but must not depend on thread timing, so
+// when non-realtime the governor is off and loadSynchronously() builds a new
+// model at the start of the next block instead of the loader thread.
+class ModelSwitcher : private juce::Thread {
+public:
+    static constexpr int numQualities { 3 };
+
+    ModelSwitcher();
+    ~ModelSwitcher() override;
+
+    // Called while the audio thread is stopped
+    void prepare(double sampleRate, int maximumBlockSize, int numChannels);
+
+    void setQuality(int quality);
+    void setGovernorEnabled(bool enabled);
+    void setActivationMode(ActivationMode mode);
+    void setNonRealtime(bool isNonRealtime);
+
+    // Audio thread
+    void loadSynchronously();
+    void setResamplingFactor(int factor);
+    void setConditioning(float sf, float delayFine);
+    void process(const float* input, float* output, int numFrames);
+    void reportLoad(double load);
+
+private:
+    static constexpr double crossfadeTime_s { 0.05 };
+    static constexpr int pollInterval_ms { 50 };
+    static constexpr double loadSmoothing { 0.05 };
+    static constexpr double governorThreshold { 0.7 };
+
+    void run() override;
+    int getTargetQuality() const;
+    std::unique_ptr<Model> createModel(int quality) const;
+    void adoptIncoming();
+    void crossfade(float* output, int numFrames);
+
+    // Owned by the audio thread
+    std::unique_ptr<Model> current;
+    std::unique_ptr<Model> previous;
+
+    // Handoff slots, each holds at most one model
+    std::atomic<Model*> incoming { nullptr };
+    std::atomic<Model*> outgoing { nullptr };
+
+    std::atomic<int> requestedQuality { 0 };
+    std::atomic<int> qualityCap { numQualities - 1 };
+    std::atomic<int> loadedQuality { 0 };
+    std::atomic<bool> governorEnabled { false };
+    std::atomic<bool> nonRealtime { false };
+    std::atomic<ActivationMode> activationMode { ActivationMode::exact };
+
+    int maximumBlockSize { 1 };
+    int numChannels { 1 };
+    double sampleRate { 44100.0 };
+    int crossfadeLength { 1 };
+    int crossfadePosition { 0 };
+    std::vector<float> previousOutput;
+
+    float conditioningSf { 0.0f };
+    float conditioningDelayFine { 0.0f };
+    double smoothedLoad { 0.0 };
+};
@@ -0,0 +1,51 @@
+#include "Modulator.h"
+
+#include <algorithm>
+#include <cmath>
+
+void Modulator::prepare(double newSampleRate)
+{
+    sampleRate = newSampleRate;
+    smoothingCoefficient = static_cast<float>(1.0 - std::exp(-controlInterval / (smoothingTime_s * sampleRate)));
+    phase = 0.0;
+    samplesUntilUpdate = 0;
+    rate = targetRate;
+    depth = targetDepth;
+}
+
+void Modulator::setRate(float rateHz)
+{
+    targetRate = rateHz;
+}
+
+void Modulator::setDepth(float newDepth)
+{
+    targetDepth = newDepth;
+}
+
+// Writes the read speed deviation caused by the LFO for every sample
+void Modulator::process(float* modulation, int numSamples)
+{
+    for (auto start = 0; start < numSamples;) {
+        if (samplesUntilUpdate == 0) {
+            rate += (targetRate - rate) * smoothingCoefficient;
+            depth += (targetDepth - depth) * smoothingCoefficient;
+            samplesUntilUpdate = controlInterval;
+        }
+
+        const auto length = std::min(samplesUntilUpdate, numSamples - start);
+        const auto increment = static_cast<double>(rate) / sampleRate;
+
+        // Triangle -1.0 to 1.0, the same shape and phase as asin(sin(x))
+        auto block = lfo.head(length);
+        block = static_cast<float>(phase) + 0.25f + static_cast<float>(increment) * ramp.head(length);
+        block = 4.0f * (block - block.floor() - 0.5f).abs() - 1.0f;
+
+        Eigen::Map<Eigen::ArrayXf>(modulation + start, length) = ((block * lfoExpScale).exp() - lfoExpMean) * (depth * depthScale);
+
+        phase += increment * length;
+        phase -= std::floor(phase);
+        samplesUntilUpdate -= length;
+        start += length;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Eigen/Dense>
+
+// Triangle LFO and its exponential mapping onto the delay read speed, produced
+// a block at a time. Rate and depth are smoothed at control rate, once every
+// controlInterval samples counted across blocks, so the result does not depend
+// on how the host splits them.
+class Modulator {
+public:
+    void prepare(double sampleRate);
+    void setRate(float rateHz);
+    void setDepth(float depth);
+    void process(float* modulation, int numSamples);
+
+private:
+    static constexpr int controlInterval { 32 };
+    static constexpr double smoothingTime_s { 0.05 };
+
+    // 4^lfo is centred on its mean over one triangle period, (4 - 1/4) / ln(16)
+    static constexpr float lfoExpMean { 1.3525266f };
+    static constexpr float lfoExpScale { 1.3862944f }; // ln(4)
+    static constexpr float depthScale { 0.7f };
+
+    using ControlBlock = Eigen::Array<float, controlInterval, 1>;
+
+    double sampleRate { 44100.0 };
+    double phase { 0.0 };
+    float smoothingCoefficient { 1.0f };
+    int samplesUntilUpdate { 0 };
+
+    float targetRate { 0.1f };
+    float rate { 0.1f };
+    float targetDepth { 0.0f };
+    float depth { 0.0f };
+
+    ControlBlock ramp { ControlBlock::LinSpaced(0.0f, static_cast<float>(controlInterval - 1)) };
+    ControlBlock lfo { ControlBlock::Zero() };
+};
@@ -1,5 +1,7 @@
 #include "Processor.h"
+#include "AllocationTrap.h"
 #include "Editor.h"
+#include "Profiler.h"
 
 #include <fmt/core.h>
 
@@ -7,23 +9,23 @@ Processor::Processor()
     : AudioProcessor(getBusesProperties())
     , state(*this, nullptr, "state", getParameterLayout())
 {
-    state.addParameterListener("mix", this);
-    state.addParameterListener("regen", this);
-    state.addParameterListener("sf", this);
-    state.addParameterListener("coarse", this);
-    state.addParameterListener("fine", this);
-    state.addParameterListener("rate", this);
-    state.addParameterListener("depth", this);
-
-    mix = state.getRawParameterValue("mix")->load();
-    regen = state.getRawParameterValue("regen")->load();
-    sf = static_cast<bool>(state.getRawParameterValue("sf")->load());
-    coarse = state.getRawParameterValue("coarse")->load();
-    coarseMapped = juce::jmap(coarse, 0.0f, 1.0f, 1.0f, 0.0f);
-    fine = state.getRawParameterValue("fine")->load();
-    fineMapped = juce::jmap(fine, 0.0f, 1.0f, 4.0f, 1.0f);
-    rate = state.getRawParameterValue("rate")->load();
-    depth = state.getRawParameterValue("depth")->load();
+    mixParameter = state.getRawParameterValue("mix");
+    regenParameter = state.getRawParameterValue("regen");
+    sfParameter = state.getRawParameterValue("sf");
+    coarseParameter = state.getRawParameterValue("coarse");
+    fineParameter = state.getRawParameterValue("fine");
+    rateParameter = state.getRawParameterValue("rate");
+    depthParameter = state.getRawParameterValue("depth");
+    nativeRateParameter = state.getRawParameterValue("nativeRate");
+
+    // ModelSwitcher takes these from any thread
+    state.addParameterListener("accuracy", this);
+    state.addParameterListener("quality", this);
+    state.addParameterListener("governor", this);
+
+    models.setActivationMode(static_cast<ActivationMode>(static_cast<int>(state.getRawParameterValue("accuracy")->load())));
+    models.setQuality(static_cast<int>(state.getRawParameterValue("quality")->load()));
+    models.setGovernorEnabled(static_cast<bool>(state.getRawParameterValue("governor")->load()));
 }
 
 const juce::String Processor::getName() const
@@ -90,14 +92,36 @@ void Processor::prepareToPlay(double sampleRate, int maximumExpectedSamplesPerBl
     fmt::print("Maximum expected samples per block: {}\n", spec.maximumBlockSize);
     fmt::print("Num channels: {}\n", spec.numChannels);
 
-    oscillator.reset();
-    oscillator.prepare(spec);
-    // triangle wave (-1.0 to 1.0)
-    oscillator.initialise([](float x) { return (2 / juce::float_Pi) * std::asin(std::sin(x)); });
-    oscillator.setFrequency(rate);
-
-    auto delayInSamples = calculateDelayInSamples(coarseMapped, getSampleRate());
-    delayLine.setDelayInSamples(delayInSamples, sf ? fineMapped * 2.0f : fineMapped);
+    auto numChannels = std::max(getTotalNumInputChannels(), 1);
+    resampler.prepare(calculateResamplingFactor(sampleRate), numChannels);
+    resamplerActive = false;
+
+    delayLines.resize(static_cast<size_t>(numChannels));
+    for (auto& delayLine : delayLines)
+        delayLine.prepare(sampleRate);
+    delayInSamples = -1.0;
+
+    auto maxBlockSize = std::max(maximumExpectedSamplesPerBlock, 1);
+    modulation.assign(static_cast<size_t>(maxBlockSize), 0.0f);
+    mixRamp.assign(static_cast<size_t>(maxBlockSize), 0.0f);
+    regenRamp.assign(static_cast<size_t>(maxBlockSize), 0.0f);
+    sampleRateRatioRamp.assign(static_cast<size_t>(maxBlockSize), 0.0f);
+    delayOutput.assign(static_cast<size_t>(maxBlockSize * numChannels), 0.0f);
+    modelOutput.assign(static_cast<size_t>(maxBlockSize * numChannels), 0.0f);
+    nativeInput.assign(static_cast<size_t>(maxBlockSize * numChannels), 0.0f);
+    nativeOutput.assign(static_cast<size_t>(maxBlockSize * numChannels), 0.0f);
+    models.prepare(sampleRate, maxBlockSize, numChannels);
+    loadMonitor.reset();
+
+    // Start on the current values instead of ramping from the last ones
+    mix.reset(sampleRate, smoothingTime_s);
+    regen.reset(sampleRate, smoothingTime_s);
+    sampleRateRatio.reset(sampleRate, smoothingTime_s);
+    updateParameters();
+    mix.setCurrentAndTargetValue(mix.getTargetValue());
+    regen.setCurrentAndTargetValue(regen.getTargetValue());
+    sampleRateRatio.setCurrentAndTargetValue(sampleRateRatio.getTargetValue());
+    modulator.prepare(sampleRate);
 }
 
 void Processor::releaseResources()
@@ -107,25 +131,187 @@ void Processor::releaseResources()
 
 void Processor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    DDS19_PROFILE_ZONE("block");
     juce::ignoreUnused(midiMessages);
+
+    // Offline renders may allocate, and must not depend on the loader thread
+    if (isNonRealtime())
+        models.loadSynchronously();
+
     juce::ScopedNoDenormals noDenormals;
+    ScopedAllocationTrap allocationTrap;
+    juce::ignoreUnused(allocationTrap);
+    auto startTicks = juce::Time::getHighResolutionTicks();
+
+    updateParameters();
+
+    // Hosts may exceed the announced block size, so work in prepared-size segments
+    auto maxSegmentSize = static_cast<int>(modulation.size());
+    for (auto start = 0; start < buffer.getNumSamples(); start += maxSegmentSize) {
+        auto numSamples = std::min(maxSegmentSize, buffer.getNumSamples() - start);
+        {
+            DDS19_PROFILE_ZONE("lfo");
+            modulator.process(modulation.data(), numSamples);
+        }
+        updateRamps(numSamples);
 
-    auto numChannels = getTotalNumInputChannels();
-    for (auto channel = 0; channel < numChannels; ++channel) {
-        auto* channelData = buffer.getWritePointer(channel);
+        if (delayLines.front().canReadAhead(static_cast<size_t>(numSamples)))
+            processPipelined(buffer, start, numSamples);
+        else
+            processSampleBySample(buffer, start, numSamples);
+    }
 
-        for (auto sampleIndex = 0; sampleIndex < buffer.getNumSamples(); sampleIndex++) {
+    // Share of the block duration spent processing it
+    if (buffer.getNumSamples() > 0) {
+        auto elapsed_s = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+        auto load = elapsed_s * getSampleRate() / buffer.getNumSamples();
+        models.reportLoad(load);
+        loadMonitor.record(load);
+    }
+}
+
+void Processor::setNonRealtime(bool isNonRealtime) noexcept
+{
+    juce::AudioProcessor::setNonRealtime(isNonRealtime);
+    models.setNonRealtime(isNonRealtime);
+}
+
+// All channels advance together, so every model step is one batched step over
+// the channel states
+void Processor::processSampleBySample(juce::AudioBuffer<float>& buffer, int start, int numSamples)
+{
+    DDS19_PROFILE_STAGES(stages, "delay read", "model", "delay write");
+    auto numChannels = static_cast<int>(delayLines.size());
+    for (auto sampleIndex = start; sampleIndex < start + numSamples; sampleIndex++) {
+        auto index = static_cast<size_t>(sampleIndex - start);
+        auto sampleRatio = sampleRateRatioRamp[index];
+        for (auto channel = 0; channel < numChannels; channel++)
+            delayOutput[static_cast<size_t>(channel)] = delayLines[static_cast<size_t>(channel)].out(sampleRatio, modulation[index]);
+        DDS19_PROFILE_LAP(stages, 0);
+
+        runModel(1);
+        DDS19_PROFILE_LAP(stages, 1);
+
+        for (auto channel = 0; channel < numChannels; channel++) {
+            auto* channelData = buffer.getWritePointer(channel);
             auto inputSample = channelData[sampleIndex];
-            auto lfo = oscillator.processSample(0.0f);
-            auto sampleRateRatio = sf ? fineMapped * 2.0f : fineMapped;
-            auto outputSample = delayLine.out(sampleRateRatio, lfo, depth);
-            auto modelOutputSample = model.process(outputSample, sf ? 1.0f : 0.0f, fine);
-            delayLine.in(inputSample + modelOutputSample * regen, sampleRateRatio);
-            channelData[sampleIndex] = inputSample * (1.0f - mix) + modelOutputSample * mix;
+            auto modelOutputSample = modelOutput[static_cast<size_t>(channel)];
+            delayLines[static_cast<size_t>(channel)].in(inputSample + modelOutputSample * regenRamp[index], sampleRatio);
+            channelData[sampleIndex] = inputSample * (1.0f - mixRamp[index]) + modelOutputSample * mixRamp[index];
         }
+        DDS19_PROFILE_LAP(stages, 2);
     }
 }
 
+// The whole block of delay reads only depends on samples written before the
+// block, so they are gathered first, the model runs over the block in one go
+// and the feedback writes follow
+void Processor::processPipelined(juce::AudioBuffer<float>& buffer, int start, int numSamples)
+{
+    auto numChannels = static_cast<int>(delayLines.size());
+    {
+        DDS19_PROFILE_ZONE("delay read");
+        for (auto channel = 0; channel < numChannels; channel++) {
+            auto& delayLine = delayLines[static_cast<size_t>(channel)];
+            for (auto sampleIndex = 0; sampleIndex < numSamples; sampleIndex++) {
+                auto index = static_cast<size_t>(sampleIndex);
+                delayOutput[index * delayLines.size() + static_cast<size_t>(channel)] = delayLine.out(sampleRateRatioRamp[index], modulation[index], index);
+            }
+        }
+    }
+
+    runModel(numSamples);
+
+    DDS19_PROFILE_ZONE("delay write");
+    for (auto channel = 0; channel < numChannels; channel++) {
+        auto& delayLine = delayLines[static_cast<size_t>(channel)];
+        auto* channelData = buffer.getWritePointer(channel, start);
+        for (auto sampleIndex = 0; sampleIndex < numSamples; sampleIndex++) {
+            auto index = static_cast<size_t>(sampleIndex);
+            auto inputSample = channelData[sampleIndex];
+            auto modelOutputSample = modelOutput[index * delayLines.size() + static_cast<size_t>(channel)];
+            delayLine.in(inputSample + modelOutputSample * regenRamp[index], sampleRateRatioRamp[index]);
+            channelData[sampleIndex] = inputSample * (1.0f - mixRamp[index]) + modelOutputSample * mixRamp[index];
+        }
+    }
+}
+
+// Runs the model on the interleaved delay output, at the training sample rate
+// when resampling is active
+void Processor::runModel(int numSamples)
+{
+    if (!resamplerActive) {
+        models.process(delayOutput.data(), modelOutput.data(), numSamples);
+        return;
+    }
+
+    int numNativeFrames;
+    {
+        DDS19_PROFILE_ZONE("decimate");
+        numNativeFrames = resampler.decimate(delayOutput.data(), nativeInput.data(), numSamples);
+    }
+
+    models.process(nativeInput.data(), nativeOutput.data(), numNativeFrames);
+
+    DDS19_PROFILE_ZONE("interpolate");
+    resampler.interpolate(nativeOutput.data(), modelOutput.data(), numSamples);
+}
+
+// Takes the values the host published since the last block. However many
+// automation points arrived in between, the mapped values and the delay are
+// worked out once here, and the continuous parameters ramp towards them.
+void Processor::updateParameters()
+{
+    auto sf = sfParameter->load() > 0.5f;
+    auto fine = fineParameter->load();
+    auto fineMapped = juce::jmap(fine, 0.0f, 1.0f, 4.0f, 1.0f);
+    auto coarseMapped = juce::jmap(coarseParameter->load(), 0.0f, 1.0f, 1.0f, 0.0f);
+
+    mix.setTargetValue(mixParameter->load());
+    regen.setTargetValue(regenParameter->load());
+    sampleRateRatio.setTargetValue(sf ? fineMapped * 2.0f : fineMapped);
+    modulator.setRate(rateParameter->load());
+    modulator.setDepth(depthParameter->load());
+    models.setConditioning(sf ? 1.0f : 0.0f, fine);
+
+    auto useResampler = nativeRateParameter->load() > 0.5f && resampler.getFactor() > 1;
+    if (useResampler != resamplerActive) {
+        resampler.reset();
+        resamplerActive = useResampler;
+        models.setResamplingFactor(resamplerActive ? resampler.getFactor() : 1);
+    }
+
+    updateDelay(coarseMapped);
+}
+
+void Processor::updateRamps(int numSamples)
+{
+    for (auto index = 0; index < numSamples; index++) {
+        mixRamp[static_cast<size_t>(index)] = mix.getNextValue();
+        regenRamp[static_cast<size_t>(index)] = regen.getNextValue();
+        sampleRateRatioRamp[static_cast<size_t>(index)] = sampleRateRatio.getNextValue();
+    }
+}
+
+// COARSE steps the delay between powers of two, so it is switched rather than
+// ramped, and only when it changes
+void Processor::updateDelay(float coarseMapped)
+{
+    // The resampling filters delay the wet path only. Reading the delay line
+    // that much earlier keeps every repeat on time, so the dry signal is not
+    // delayed and there is no plugin latency to report.
+    auto newDelayInSamples = calculateDelayInSamples(coarseMapped, getSampleRate());
+    if (resamplerActive)
+        newDelayInSamples -= resampler.getLatencyInSamples();
+
+    if (newDelayInSamples == delayInSamples)
+        return;
+
+    delayInSamples = newDelayInSamples;
+    for (auto& delayLine : delayLines)
+        delayLine.setDelayInSamples(delayInSamples, sampleRateRatio.getTargetValue());
+}
+
 bool Processor::hasEditor() const
 {
     return true;
@@ -150,26 +336,12 @@ void Processor::setStateInformation(const void* data, int sizeInBytes)
 
 void Processor::parameterChanged(const juce::String& parameterID, float newValue)
 {
-    if (parameterID == "mix") {
-        mix = newValue;
-    } else if (parameterID == "regen") {
-        regen = newValue;
-    } else if (parameterID == "sf") {
-        sf = static_cast<bool>(newValue);
-    } else if (parameterID == "coarse") {
-        coarse = newValue;
-        coarseMapped = juce::jmap(coarse, 0.0f, 1.0f, 1.0f, 0.0f);
-        auto delayInSamples = calculateDelayInSamples(coarseMapped, getSampleRate());
-        delayLine.setDelayInSamples(delayInSamples, sf ? fineMapped * 2.0f : fineMapped);
-    } else if (parameterID == "fine") {
-        fine = newValue;
-        fineMapped = juce::jmap(fine, 0.0f, 1.0f, 4.0f, 1.0f);
-    } else if (parameterID == "rate") {
-        rate = newValue;
-        oscillator.setFrequency(rate);
-    } else if (parameterID == "depth") {
-        depth = newValue;
-    }
+    if (parameterID == "accuracy")
+        models.setActivationMode(static_cast<ActivationMode>(static_cast<int>(newValue)));
+    else if (parameterID == "quality")
+        models.setQuality(static_cast<int>(newValue));
+    else if (parameterID == "governor")
+        models.setGovernorEnabled(static_cast<bool>(newValue));
 }
 
 Processor::State& Processor::getState()
@@ -177,9 +349,14 @@ Processor::State& Processor::getState()
     return state;
 }
 
+LoadMonitor& Processor::getLoadMonitor()
+{
+    return loadMonitor;
+}
+
 bool Processor::isBusesLayoutSupported(const juce::AudioProcessor::BusesLayout& layout) const
 {
-    if (layout.getMainOutputChannelSet().size() > maxNumChannels)
+    if (layout.getMainOutputChannelSet().isDisabled() || layout.getMainOutputChannelSet().size() > maxNumChannels)
         return false;
 
     if (layout.getMainInputChannelSet() != layout.getMainOutputChannelSet())
@@ -191,8 +368,8 @@ bool Processor::isBusesLayoutSupported(const juce::AudioProcessor::BusesLayout&
 juce::AudioProcessor::BusesProperties Processor::getBusesProperties()
 {
     return BusesProperties()
-        .withInput("Input", juce::AudioChannelSet::mono(), true)
-        .withOutput("Output", juce::AudioChannelSet::mono(), true);
+        .withInput("Input", juce::AudioChannelSet::stereo(), true)
+        .withOutput("Output", juce::AudioChannelSet::stereo(), true);
 }
 
 Processor::ParameterLayout Processor::getParameterLayout()
@@ -205,6 +382,10 @@ Processor::ParameterLayout Processor::getParameterLayout()
         std::make_unique<juce::AudioParameterFloat>("fine", "Fine", 0.0f, 1.0f, 1.0f),
         std::make_unique<juce::AudioParameterFloat>("rate", "Rate", 0.1f, 10.0f, 0.1f),
         std::make_unique<juce::AudioParameterFloat>("depth", "Depth", 0.0f, 1.0f, 0.0f),
+        std::make_unique<juce::AudioParameterChoice>("accuracy", "Accuracy", juce::StringArray { "Exact", "Fast", "Ultra fast" }, 0),
+        std::make_unique<juce::AudioParameterChoice>("quality", "Model quality", juce::StringArray { "LSTM 32 (tracking)", "LSTM 64", "LSTM 96 (mixing)" }, 0),
+        std::make_unique<juce::AudioParameterBool>("governor", "CPU governor", false),
+        std::make_unique<juce::AudioParameterBool>("nativeRate", "Model at 44.1 kHz", false),
     };
 }
 
@@ -231,6 +412,14 @@ double Processor::calculateDelayInSamples(float coarse, double sampleRate)
     return delay - 1;
 }
 
+// Integer factor that brings the host rate closest to the model rate, e.g. 2
+// at 88.2 and 96 kHz, 4 at 176.4 and 192 kHz. At 96 kHz this runs the model at
+// 48 kHz, which is far closer to its training rate than 96 kHz.
+int Processor::calculateResamplingFactor(double sampleRate)
+{
+    return std::max(1, static_cast<int>(sampleRate / modelSampleRate + 0.25));
+}
+
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 {
     return new Processor();
@@ -4,7 +4,12 @@
 #include <juce_dsp/juce_dsp.h>
 
 #include "DelayLine.h"
-#include "Model.h"
+#include "LoadMonitor.h"
+#include "ModelSwitcher.h"
+#include "Modulator.h"
+#include "Resampler.h"
+
+#include <atomic>
 
 class Processor : public juce::AudioProcessor,
                   public juce::AudioProcessorValueTreeState::Listener {
@@ -26,6 +31,7 @@ public:
     void prepareToPlay(double sampleRate, int maximumExpectedSamplesPerBlock) override;
     void releaseResources() override;
     void processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages) override;
+    void setNonRealtime(bool isNonRealtime) noexcept override;
     bool hasEditor() const override;
     juce::AudioProcessorEditor* createEditor() override;
     void getStateInformation(juce::MemoryBlock& destData) override;
@@ -33,37 +39,71 @@ public:
     void parameterChanged(const juce::String& parameterID, float newValue) override;
 
     State& getState();
+    LoadMonitor& getLoadMonitor();
 
 protected:
     bool isBusesLayoutSupported(const BusesLayout& layout) const override;
 
 private:
-    using Oscillator = juce::dsp::Oscillator<float>;
+    void processSampleBySample(juce::AudioBuffer<float>& buffer, int start, int numSamples);
+    void processPipelined(juce::AudioBuffer<float>& buffer, int start, int numSamples);
+    void runModel(int numSamples);
+    void updateParameters();
+    void updateRamps(int numSamples);
+    void updateDelay(float coarseMapped);
 
     static BusesProperties getBusesProperties();
     static ParameterLayout getParameterLayout();
     static double calculateDelayInSamples(float coarse, double sampleRate);
+    static int calculateResamplingFactor(double sampleRate);
 
-    static constexpr int maxNumChannels { 1 };
+    static constexpr int maxNumChannels { 8 };
     static constexpr double delayElement_ms { 0.008f };
     static constexpr float lfoMax { 4.0f };
     static constexpr float lfoMin { 1.0f };
+    static constexpr double smoothingTime_s { 0.05 };
+
+    // SAMPLE_RATE of the training data in dds-nn/train.py
+    static constexpr double modelSampleRate { 44100.0 };
 
     State state;
 
-    float mix { 0.0f };
-    float regen { 0.0f };
-    bool sf { false };
-    float coarse { 1.0f };
-    float coarseMapped { 0.0f };
-    float fine { 1.0f };
-    float fineMapped { 1.0f };
-    float rate { 1.0f };
-    float depth { 0.0f };
-
-    DelayLine delayLine;
-    Model model;
-    Oscillator oscillator;
+    // Published by the host from any thread, read once per block by the
+    // audio thread. Only the model switching parameters use the listener.
+    std::atomic<float>* mixParameter { nullptr };
+    std::atomic<float>* regenParameter { nullptr };
+    std::atomic<float>* sfParameter { nullptr };
+    std::atomic<float>* coarseParameter { nullptr };
+    std::atomic<float>* fineParameter { nullptr };
+    std::atomic<float>* rateParameter { nullptr };
+    std::atomic<float>* depthParameter { nullptr };
+    std::atomic<float>* nativeRateParameter { nullptr };
+
+    // Audio thread
+    bool resamplerActive { false };
+    double delayInSamples { -1.0 };
+
+    // Ramps towards the values of the current block, taken one sample at a
+    // time into the per-sample buffers below
+    juce::SmoothedValue<float> mix;
+    juce::SmoothedValue<float> regen;
+    juce::SmoothedValue<float> sampleRateRatio;
+
+    // One delay line per channel, channel samples are interleaved in the buffers
+    std::vector<DelayLine> delayLines;
+    ModelSwitcher models;
+    Modulator modulator;
+    Resampler resampler;
+    LoadMonitor loadMonitor;
+
+    std::vector<float> modulation;
+    std::vector<float> mixRamp;
+    std::vector<float> regenRamp;
+    std::vector<float> sampleRateRatioRamp;
+    std::vector<float> delayOutput;
+    std::vector<float> modelOutput;
+    std::vector<float> nativeInput;
+    std::vector<float> nativeOutput;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Processor)
 };
@@ -0,0 +1,103 @@
+#include "Profiler.h"
+
+#if DDS19_PROFILING
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+namespace {
+struct Event {
+    const char* name;
+    std::int64_t start_ns;
+    std::int64_t end_ns;
+    int threadId;
+};
+
+std::vector<Event> events;
+std::atomic<std::size_t> numEvents { 0 };
+std::atomic<bool> running { false };
+std::int64_t origin_ns { 0 };
+
+std::atomic<int> nextThreadId { 0 };
+thread_local int threadId { -1 };
+thread_local int suppressionDepth { 0 };
+
+int getThreadId()
+{
+    if (threadId < 0)
+        threadId = nextThreadId.fetch_add(1, std::memory_order_relaxed);
+
+    return threadId;
+}
+}
+
+void Profiler::start(std::size_t capacity)
+{
+    events.assign(capacity, Event {});
+    numEvents = 0;
+    origin_ns = now();
+    running = true;
+}
+
+void Profiler::stop()
+{
+    running = false;
+}
+
+std::size_t Profiler::getNumDroppedEvents()
+{
+    return numEvents.load() - std::min(numEvents.load(), events.size());
+}
+
+bool Profiler::isRecording()
+{
+    return running.load(std::memory_order_relaxed) && suppressionDepth == 0;
+}
+
+void Profiler::setZonesSuppressed(bool suppressed)
+{
+    suppressionDepth += suppressed ? 1 : -1;
+}
+
+std::int64_t Profiler::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::record(const char* name, std::int64_t start_ns, std::int64_t end_ns)
+{
+    if (!running.load(std::memory_order_relaxed))
+        return;
+
+    auto index = numEvents.fetch_add(1, std::memory_order_relaxed);
+    if (index < events.size())
+        events[index] = Event { name, start_ns, end_ns, getThreadId() };
+}
+
+// Complete ("X") events with microsecond timestamps relative to start()
+bool Profiler::writeChromeTrace(const std::string& path)
+{
+    std::ofstream file(path);
+    if (!file)
+        return false;
+
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    auto count = std::min(numEvents.load(), events.size());
+    for (size_t i = 0; i < count; i++) {
+        const auto& event = events[i];
+        file << (i == 0 ? "\n" : ",\n")
+             << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.threadId
+             << ",\"ts\":" << static_cast<double>(event.start_ns - origin_ns) / 1000.0
+             << ",\"dur\":" << static_cast<double>(event.end_ns - event.start_ns) / 1000.0 << "}";
+    }
+    file << "\n]}\n";
+
+    return static_cast<bool>(file);
+}
+
+#endif
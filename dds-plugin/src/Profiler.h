@@ -0,0 +1,128 @@
+#pragma once
+
+// Trace zones on the stages of the hot path for offline profiling. When the
+// plugin is built with DDS19_PROFILING, every DDS19_PROFILE_ZONE records its
+// start and end into a preallocated event buffer while the Profiler is
+// running, and the buffer can be written as Chrome trace event JSON, which
+// chrome://tracing and ui.perfetto.dev open directly. Without the option the
+// zones expand to nothing.
+//
+// Recording takes two clock reads and one atomic increment and never
+// allocates. Events beyond the buffer capacity are dropped and counted. Loops
+// that run per sample use DDS19_PROFILE_STAGES instead, which sums the time of
+// each stage and records one event per stage when it goes out of scope.
+
+#if DDS19_PROFILING
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Profiler {
+public:
+    static constexpr std::size_t defaultCapacity { 1 << 21 };
+
+    // Called while no zones are being recorded
+    static void start(std::size_t capacity = defaultCapacity);
+    static void stop();
+    static bool writeChromeTrace(const std::string& path);
+    static std::size_t getNumDroppedEvents();
+
+    // False while stopped and inside ProfileStages on the calling thread
+    static bool isRecording();
+    static void setZonesSuppressed(bool suppressed);
+
+    static std::int64_t now();
+    static void record(const char* name, std::int64_t start_ns, std::int64_t end_ns);
+};
+
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* zoneName)
+        : name(zoneName)
+        , start_ns(Profiler::isRecording() ? Profiler::now() : -1)
+    {
+    }
+
+    ~ProfileZone()
+    {
+        if (start_ns >= 0)
+            Profiler::record(name, start_ns, Profiler::now());
+    }
+
+private:
+    const char* name;
+    std::int64_t start_ns;
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+};
+
+// Stages of a loop, timed with one clock read per lap. lap(stage) ends the
+// stage that began at the previous lap. The sums are recorded back to back
+// from where the stages started. Zones inside are not recorded, their time
+// counts towards the enclosing stage.
+template <std::size_t NumStages>
+class ProfileStages {
+public:
+    explicit ProfileStages(const char* const (&stageNames)[NumStages])
+        : names(stageNames)
+        , recording(Profiler::isRecording())
+    {
+        if (!recording)
+            return;
+
+        Profiler::setZonesSuppressed(true);
+        start_ns = Profiler::now();
+        lap_ns = start_ns;
+    }
+
+    ~ProfileStages()
+    {
+        if (!recording)
+            return;
+
+        Profiler::setZonesSuppressed(false);
+        auto stageStart_ns = start_ns;
+        for (std::size_t stage = 0; stage < NumStages; stage++) {
+            Profiler::record(names[stage], stageStart_ns, stageStart_ns + total_ns[stage]);
+            stageStart_ns += total_ns[stage];
+        }
+    }
+
+    void lap(std::size_t stage)
+    {
+        if (!recording)
+            return;
+
+        const auto now_ns = Profiler::now();
+        total_ns[stage] += now_ns - lap_ns;
+        lap_ns = now_ns;
+    }
+
+private:
+    const char* const* names;
+    bool recording;
+    std::int64_t start_ns { 0 };
+    std::int64_t lap_ns { 0 };
+    std::int64_t total_ns[NumStages] {};
+
+    ProfileStages(const ProfileStages&) = delete;
+    ProfileStages& operator=(const ProfileStages&) = delete;
+};
+
+#define DDS19_PROFILE_CONCAT_INNER(a, b) a##b
+#define DDS19_PROFILE_CONCAT(a, b) DDS19_PROFILE_CONCAT_INNER(a, b)
+#define DDS19_PROFILE_ZONE(name) const ProfileZone DDS19_PROFILE_CONCAT(profileZone, __LINE__) { name }
+#define DDS19_PROFILE_STAGES(stages, ...)                         \
+    static constexpr const char* stages##Names[] { __VA_ARGS__ }; \
+    ProfileStages stages { stages##Names }
+#define DDS19_PROFILE_LAP(stages, stage) stages.lap(stage)
+
+#else
+
+#define DDS19_PROFILE_ZONE(name)
+#define DDS19_PROFILE_STAGES(stages, ...)
+#define DDS19_PROFILE_LAP(stages, stage)
+
+#endif
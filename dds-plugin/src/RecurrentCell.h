@@ -0,0 +1,141 @@
+#pragma once
+
+#include "Activation.h"
+#include "Profiler.h"
+#include "RecurrentEngine.h"
+#include "RecurrentProduct.h"
+
+#include <Eigen/Dense>
+#include <algorithm>
+
+// Single layer recurrent cell followed by a linear layer, the part shared by
+// Lstm and Gru. HiddenSize is either one of the shipped model sizes, which lets
+// Eigen use fixed-size kernels without runtime size checks or temporaries, or
+// Eigen::Dynamic for any other model. State and gates hold one column per
+// channel, so the input projection, activations and linear layer run as single
+// matrix operations over all channels.
+//
+// Cell derives from this class and supplies the step itself:
+//  prepareState(numChannels) - sizes and clears its own state
+//  addRecurrent()            - adds the recurrent products to the gates
+//  activate<Mode>()          - turns the gates into the next h_t
+template <typename Cell, int HiddenSize, int NumGates>
+class RecurrentCell : public RecurrentEngine {
+public:
+    explicit RecurrentCell(const RecurrentWeights& weights)
+        : recurrent(weights)
+        , weightIh(weights.weightIh, weights.gateSize, inputSize)
+        , bias(weights.bias, weights.gateSize)
+        , linearWeight(weights.linearWeight, 1, weights.hiddenSize)
+        , linearBias(weights.linearBias[0])
+    {
+        effectiveBias = bias;
+    }
+
+    void prepare(int maximumBlockSize, int numChannels) final
+    {
+        const auto gateSize = recurrent.gateSize();
+        const auto hiddenSize = recurrent.hiddenSize();
+        const auto maxFrames = std::clamp(maximumBlockSize, 1, std::max(1, maxProjectionColumns / numChannels));
+
+        gates.setZero(gateSize, numChannels);
+        h_t.setZero(hiddenSize, numChannels);
+        projections.setZero(gateSize, maxFrames * numChannels);
+        static_cast<Cell&>(*this).prepareState(numChannels);
+    }
+
+    // The conditioning inputs only change with the controls, so their
+    // projection is folded into the gate bias instead of recomputed per sample
+    void setConditioning(float sf, float delayFine) final
+    {
+        effectiveBias = bias + sf * weightIh.col(1) + delayFine * weightIh.col(2);
+    }
+
+    // Projects the inputs of a whole block onto the gates with one matrix
+    // product, leaving only the recurrent part to run frame by frame
+    void process(const float* input, float* output, int numFrames) final
+    {
+        DDS19_PROFILE_STAGES(stages, "input projection", "recurrent gates", "activations", "linear head");
+        const auto numChannels = h_t.cols();
+        const auto chunkFrames = static_cast<int>(projections.cols() / numChannels);
+        for (auto start = 0; start < numFrames; start += chunkFrames) {
+            const auto length = std::min(chunkFrames, numFrames - start);
+            auto chunk = projections.leftCols(length * numChannels);
+            const InputBlock samples(input + start * numChannels, length * numChannels);
+            chunk.noalias() = weightIh.col(0) * samples;
+            chunk.colwise() += effectiveBias;
+            DDS19_PROFILE_LAP(stages, 0);
+
+            for (auto frame = 0; frame < length; frame++) {
+                gates = chunk.middleCols(frame * numChannels, numChannels);
+                static_cast<Cell&>(*this).addRecurrent();
+                DDS19_PROFILE_LAP(stages, 1);
+
+                updateState();
+                DDS19_PROFILE_LAP(stages, 2);
+
+                OutputFrame outputFrame(output + (start + frame) * numChannels, numChannels);
+                outputFrame.noalias() = linearWeight * h_t;
+                outputFrame.array() += linearBias;
+                DDS19_PROFILE_LAP(stages, 3);
+            }
+        }
+    }
+
+protected:
+    // Keeps the block projections resident in L2 for long host blocks
+    static constexpr int maxProjectionColumns { 256 };
+
+    static constexpr int gateSize { HiddenSize == Eigen::Dynamic ? Eigen::Dynamic : NumGates * HiddenSize };
+
+    using GateVector = Eigen::Matrix<float, gateSize, 1>;
+    using GateState = typename RecurrentProduct<gateSize, HiddenSize>::GateState;
+    using HiddenState = typename RecurrentProduct<gateSize, HiddenSize>::HiddenState;
+
+    auto gate(Eigen::Index index)
+    {
+        return gates.template middleRows<HiddenSize>(index * h_t.rows(), h_t.rows()).array();
+    }
+
+    auto sigmoidGate(Eigen::Index index)
+    {
+        return 0.5f * gate(index) + 0.5f;
+    }
+
+    RecurrentProduct<gateSize, HiddenSize> recurrent;
+    GateState gates;
+    HiddenState h_t;
+
+private:
+    static constexpr int inputSize { 3 };
+
+    using InputBlock = Eigen::Map<const Eigen::RowVectorXf>;
+    using OutputFrame = Eigen::Map<Eigen::RowVectorXf>;
+    using InputWeights = Eigen::Map<const Eigen::Matrix<float, gateSize, inputSize>, Eigen::Aligned16>;
+    using GateBias = Eigen::Map<const GateVector, Eigen::Aligned16>;
+    using LinearWeights = Eigen::Map<const Eigen::Matrix<float, 1, HiddenSize>, Eigen::Aligned16>;
+
+    void updateState()
+    {
+        auto& cell = static_cast<Cell&>(*this);
+        switch (activationMode) {
+        case ActivationMode::exact:
+            cell.template activate<ActivationMode::exact>();
+            break;
+        case ActivationMode::fast:
+            cell.template activate<ActivationMode::fast>();
+            break;
+        case ActivationMode::ultraFast:
+            cell.template activate<ActivationMode::ultraFast>();
+            break;
+        }
+    }
+
+    InputWeights weightIh;
+    GateBias bias;
+    LinearWeights linearWeight;
+    float linearBias;
+
+    GateVector effectiveBias;
+    GateState projections;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Activation.h"
+
+#include <Eigen/Dense>
+#include <cstdint>
+
+// Model weights in the layout used by the inference engines, viewing storage
+// that outlives every engine (the generated ModelData arrays or a mapped
+// ModelFile). Matrices keep the PyTorch orientation (gates x inputs) in
+// column-major storage, so products with a state column are axpy-style GEMVs
+// that stream each weight column once. The rows of sigmoid gates (LSTM input,
+// forget and output, GRU reset and update) are pre-scaled by 0.5 so that a
+// single tanh pass over all gates yields every activation, using
+// sigmoid(x) = 0.5 * tanh(x / 2) + 0.5.
+//
+// bias holds both PyTorch biases summed, except for the GRU new gate whose
+// recurrent bias is scaled by the reset gate and kept apart in recurrentBias.
+//
+// Quantized models replace weightHh with int8 values in row-major order and one
+// scale per gate row, so weightHh(row, col) ~= weightHhInt8[row * hiddenSize + col]
+// * weightHhScale[row]. Factorized models replace it with the column-major
+// low-rank factors weightHh ~= weightHhU (gates x rank) * weightHhV (rank x hidden).
+enum class CellType {
+    lstm,
+    gru
+};
+
+struct RecurrentWeights {
+    CellType cellType { CellType::lstm };
+    const float* weightIh { nullptr };
+    const float* weightHh { nullptr };
+    const std::int8_t* weightHhInt8 { nullptr };
+    const float* weightHhScale { nullptr };
+    const float* weightHhU { nullptr };
+    const float* weightHhV { nullptr };
+    const float* bias { nullptr };
+    const float* recurrentBias { nullptr };
+    const float* linearWeight { nullptr };
+    const float* linearBias { nullptr };
+
+    Eigen::Index inputSize { 0 };
+    Eigen::Index hiddenSize { 0 };
+    Eigen::Index gateSize { 0 };
+    Eigen::Index outputSize { 0 };
+    Eigen::Index recurrentRank { 0 };
+};
+
+// Runs one independent recurrent state per channel. Samples are passed as
+// interleaved frames (numFrames x numChannels).
+class RecurrentEngine {
+public:
+    virtual ~RecurrentEngine() = default;
+    virtual void prepare(int maximumBlockSize, int numChannels) = 0;
+    virtual void setConditioning(float sf, float delayFine) = 0;
+    virtual void process(const float* input, float* output, int numFrames) = 0;
+
+    void setActivationMode(ActivationMode mode) { activationMode = mode; }
+
+protected:
+    ActivationMode activationMode { ActivationMode::exact };
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "RecurrentEngine.h"
+
+#include <Eigen/Dense>
+#include <cstdint>
+
+// The recurrent weights times the hidden state, added onto the gates, for
+// dense, int8 and low-rank weights alike. Shared by the cell engines, which
+// only differ in how they combine the gates. Gates and state hold one column
+// per channel.
+template <int GateSize, int HiddenSize>
+class RecurrentProduct {
+public:
+    using GateState = Eigen::Matrix<float, GateSize, Eigen::Dynamic>;
+    using HiddenState = Eigen::Matrix<float, HiddenSize, Eigen::Dynamic>;
+
+    explicit RecurrentProduct(const RecurrentWeights& weights)
+        : weightHh(weights.weightHh, weights.gateSize, weights.hiddenSize)
+        , weightHhU(weights.weightHhU, weights.gateSize, weights.recurrentRank)
+        , weightHhV(weights.weightHhV, weights.recurrentRank, weights.hiddenSize)
+    {
+        if (weights.weightHhInt8 != nullptr) {
+            weightHhInt16 = WeightsInt8(weights.weightHhInt8, weights.gateSize, weights.hiddenSize).template cast<std::int16_t>();
+            recurrentScale = GateScale(weights.weightHhScale, weights.gateSize) / hiddenScale;
+        }
+        hiddenInt16.setZero(weightHh.cols());
+        lowRankState.setZero(weightHhV.rows());
+    }
+
+    Eigen::Index gateSize() const { return weightHh.rows(); }
+    Eigen::Index hiddenSize() const { return weightHh.cols(); }
+
+    void addTo(GateState& gates, const HiddenState& h_t)
+    {
+        if (weightHhInt16.size() > 0) {
+            addInt8(gates, h_t);
+        } else if (weightHhV.rows() > 0) {
+            // Two thin GEMVs through the rank-sized bottleneck
+            for (auto channel = 0; channel < h_t.cols(); channel++) {
+                lowRankState.noalias() = weightHhV * h_t.col(channel);
+                gates.col(channel).noalias() += weightHhU * lowRankState;
+            }
+        } else {
+            // One GEMV per channel on the shared, cache-hot weights. Eigen's
+            // GEMM repacks the constant weight matrix on every call, which
+            // measured slower than this for track channel counts.
+            for (auto channel = 0; channel < h_t.cols(); channel++)
+                gates.col(channel).noalias() += weightHh * h_t.col(channel);
+        }
+    }
+
+private:
+    // |h| <= 1, so the quantized hidden state uses a fixed full int16 scale
+    static constexpr float hiddenScale { 32767.0f };
+
+    using GateVector = Eigen::Matrix<float, GateSize, 1>;
+    using GateScale = Eigen::Map<const GateVector, Eigen::Aligned16>;
+    using HiddenWeights = Eigen::Map<const Eigen::Matrix<float, GateSize, HiddenSize>, Eigen::Aligned16>;
+    using HiddenInt16 = Eigen::Matrix<std::int16_t, HiddenSize, 1>;
+    using WeightsInt8 = Eigen::Map<const Eigen::Matrix<std::int8_t, GateSize, HiddenSize, Eigen::RowMajor>>;
+    using WeightsInt16 = Eigen::Matrix<std::int16_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+    using LowRankU = Eigen::Map<const Eigen::Matrix<float, GateSize, Eigen::Dynamic>, Eigen::Aligned16>;
+    using LowRankV = Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, HiddenSize>, Eigen::Aligned16>;
+
+    // int8 weights times the int16 hidden state, accumulated in int32. The
+    // weights are widened to an int16 copy once, so each row is a plain int16
+    // dot product that compilers vectorise with pmaddwd and similar
+    // instructions, without sign-extending bytes on every step.
+    void addInt8(GateState& gates, const HiddenState& h_t)
+    {
+        const auto numGates = gates.rows();
+        const auto numHidden = h_t.rows();
+        for (auto channel = 0; channel < h_t.cols(); channel++) {
+            hiddenInt16 = (h_t.col(channel).array() * hiddenScale).round().template cast<std::int16_t>();
+            for (auto row = 0; row < numGates; row++) {
+                const auto* weights = weightHhInt16.data() + row * numHidden;
+                std::int32_t sum { 0 };
+                for (auto col = 0; col < numHidden; col++)
+                    sum += weights[col] * hiddenInt16[col];
+                gates(row, channel) += static_cast<float>(sum) * recurrentScale[row];
+            }
+        }
+    }
+
+    HiddenWeights weightHh;
+    WeightsInt16 weightHhInt16;
+    GateVector recurrentScale;
+    LowRankU weightHhU;
+    LowRankV weightHhV;
+    Eigen::VectorXf lowRankState;
+    HiddenInt16 hiddenInt16;
+};
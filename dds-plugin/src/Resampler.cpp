@@ -0,0 +1,124 @@
+#include "Resampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+void Resampler::prepare(int newFactor, int newNumChannels)
+{
+    factor = newFactor;
+    numChannels = newNumChannels;
+    length = tapsPerPhase * factor;
+
+    // Kaiser windowed sinc lowpass
+    const auto pi = std::acos(-1.0);
+    const auto bandwidth = cutoff / factor;
+    const auto centre = (length - 1) / 2.0;
+    std::vector<double> prototype(static_cast<size_t>(length));
+    auto sum = 0.0;
+    for (auto i = 0; i < length; i++) {
+        const auto x = i - centre;
+        const auto sinc = x == 0.0 ? 1.0 : std::sin(pi * bandwidth * x) / (pi * bandwidth * x);
+        const auto position = x / centre;
+        const auto window = besselI0(kaiserBeta * std::sqrt(1.0 - position * position)) / besselI0(kaiserBeta);
+        prototype[static_cast<size_t>(i)] = sinc * window;
+        sum += prototype[static_cast<size_t>(i)];
+    }
+
+    taps.resize(static_cast<size_t>(length));
+    for (auto i = 0; i < length; i++)
+        taps[static_cast<size_t>(i)] = static_cast<float>(prototype[static_cast<size_t>(i)] / sum);
+
+    // Output phase p of the zero-stuffed signal only meets taps p, p + factor, ...
+    phaseTaps.resize(static_cast<size_t>(length));
+    for (auto phase = 0; phase < factor; phase++)
+        for (auto k = 0; k < tapsPerPhase; k++)
+            phaseTaps[static_cast<size_t>(phase * tapsPerPhase + k)] = static_cast<float>(factor) * taps[static_cast<size_t>(phase + (tapsPerPhase - 1 - k) * factor)];
+
+    decimatorHistory.resize(static_cast<size_t>(2 * length * numChannels));
+    interpolatorHistory.resize(static_cast<size_t>(2 * tapsPerPhase * numChannels));
+    reset();
+}
+
+void Resampler::reset()
+{
+    std::fill(decimatorHistory.begin(), decimatorHistory.end(), 0.0f);
+    std::fill(interpolatorHistory.begin(), interpolatorHistory.end(), 0.0f);
+    decimatorIndex = 0;
+    interpolatorIndex = 0;
+    decimatorPhase = 0;
+    interpolatorPhase = 0;
+}
+
+int Resampler::getFactor() const
+{
+    return factor;
+}
+
+int Resampler::getLatencyInSamples() const
+{
+    return factor > 1 ? length - 1 : 0;
+}
+
+int Resampler::decimate(const float* input, float* output, int numFrames)
+{
+    auto numOutputFrames = 0;
+    for (auto frame = 0; frame < numFrames; frame++) {
+        for (auto channel = 0; channel < numChannels; channel++) {
+            auto* history = decimatorHistory.data() + 2 * length * channel;
+            history[decimatorIndex] = history[decimatorIndex + length] = input[frame * numChannels + channel];
+        }
+        decimatorIndex = decimatorIndex + 1 == length ? 0 : decimatorIndex + 1;
+
+        if (decimatorPhase == 0) {
+            for (auto channel = 0; channel < numChannels; channel++) {
+                const auto* window = decimatorHistory.data() + 2 * length * channel + decimatorIndex;
+                auto sample = 0.0f;
+                for (auto i = 0; i < length; i++)
+                    sample += taps[static_cast<size_t>(i)] * window[i];
+                output[numOutputFrames * numChannels + channel] = sample;
+            }
+            numOutputFrames++;
+        }
+        decimatorPhase = decimatorPhase + 1 == factor ? 0 : decimatorPhase + 1;
+    }
+
+    return numOutputFrames;
+}
+
+void Resampler::interpolate(const float* input, float* output, int numFrames)
+{
+    auto inputFrame = 0;
+    for (auto frame = 0; frame < numFrames; frame++) {
+        if (interpolatorPhase == 0) {
+            for (auto channel = 0; channel < numChannels; channel++) {
+                auto* history = interpolatorHistory.data() + 2 * tapsPerPhase * channel;
+                history[interpolatorIndex] = history[interpolatorIndex + tapsPerPhase] = input[inputFrame * numChannels + channel];
+            }
+            interpolatorIndex = interpolatorIndex + 1 == tapsPerPhase ? 0 : interpolatorIndex + 1;
+            inputFrame++;
+        }
+
+        const auto* phase = phaseTaps.data() + interpolatorPhase * tapsPerPhase;
+        for (auto channel = 0; channel < numChannels; channel++) {
+            const auto* window = interpolatorHistory.data() + 2 * tapsPerPhase * channel + interpolatorIndex;
+            auto sample = 0.0f;
+            for (auto i = 0; i < tapsPerPhase; i++)
+                sample += phase[i] * window[i];
+            output[frame * numChannels + channel] = sample;
+        }
+        interpolatorPhase = interpolatorPhase + 1 == factor ? 0 : interpolatorPhase + 1;
+    }
+}
+
+double Resampler::besselI0(double x)
+{
+    // Power series, converges quickly for the window's argument range
+    auto sum = 1.0;
+    auto term = 1.0;
+    for (auto k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+
+    return sum;
+}
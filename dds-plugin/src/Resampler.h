@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+
+// Integer factor polyphase decimator and interpolator around a process running
+// at a lower rate. Frames are interleaved like the rest of the signal path.
+// The decimator only computes the frames it keeps and the interpolator only
+// runs the taps that meet non-zero samples, so both cost tapsPerPhase
+// multiply-adds per channel and host frame.
+//
+// Decimated frames are taken on every factor-th host frame, so a block of host
+// frames yields a varying number of decimated frames, the same number
+// interpolate consumes for that block.
+class Resampler {
+public:
+    void prepare(int factor, int numChannels);
+    void reset();
+    int getFactor() const;
+
+    // Delay of a decimate and interpolate round trip in host samples
+    int getLatencyInSamples() const;
+
+    // Returns the number of decimated frames written to output
+    int decimate(const float* input, float* output, int numFrames);
+    void interpolate(const float* input, float* output, int numFrames);
+
+private:
+    static constexpr int tapsPerPhase { 32 };
+
+    // Cutoff relative to the decimated Nyquist frequency
+    static constexpr double cutoff { 0.9 };
+    static constexpr double kaiserBeta { 8.0 };
+
+    static double besselI0(double x);
+
+    int factor { 1 };
+    int numChannels { 1 };
+    int length { 0 };
+
+    // Prototype lowpass, symmetric
+    std::vector<float> taps;
+
+    // Interpolation taps regrouped by phase, time reversed and scaled by factor
+    std::vector<float> phaseTaps;
+
+    // Per channel history, every sample is stored twice so that the newest
+    // window is always contiguous
+    std::vector<float> decimatorHistory;
+    std::vector<float> interpolatorHistory;
+    int decimatorIndex { 0 };
+    int interpolatorIndex { 0 };
+    int decimatorPhase { 0 };
+    int interpolatorPhase { 0 };
+};
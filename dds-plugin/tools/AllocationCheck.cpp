@@ -0,0 +1,173 @@
+// Realtime safety check of the whole processor. Built with
+// DDS19_ALLOCATION_CHECK, which turns on DDS19_ALLOCATION_TRAP, so any heap
+// allocation inside processBlock aborts with a message.
+//
+// Usage: DDS19AllocationCheck [--self-test]
+//
+// For every sample rate and host block size, every parameter is stepped
+// through its values, once from the defaults and once with everything else
+// busy: S/F, the longest delay, full regeneration, modulation and the model at
+// 44.1 kHz. After each change the processor runs long enough for a new model
+// to be crossfaded, in blocks of the announced size, shorter ones and one
+// longer than announced. --self-test allocates inside a trap and should abort,
+// to confirm the build traps at all.
+//
+// Eigen allocates with malloc, past the trapped operator new, and before
+// Eigen 3.4.90 its malloc check is one flag for the whole process. The
+// processor therefore runs non-realtime: new models are built on the audio
+// thread before the trap is armed, the loader thread stays idle and the
+// process-wide flag only ever sees the audio thread.
+
+#include "AllocationTrap.h"
+#include "Processor.h"
+
+#include <fmt/core.h>
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if !DDS19_ALLOCATION_TRAP
+#error "Configure with DDS19_ALLOCATION_CHECK"
+#endif
+
+namespace {
+constexpr int numChannels { 2 };
+constexpr int blockSizes[] { 1, 17, 64, 512, 4096 };
+constexpr double sampleRates[] { 44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0 };
+
+// Longer than a crossfade, ModelSwitcher::crossfadeTime_s
+constexpr double settleTime_s { 0.1 };
+
+const std::vector<std::pair<const char*, float>> busyValues {
+    { "regen", 1.0f },
+    { "sf", 1.0f },
+    { "coarse", 0.0f },
+    { "depth", 1.0f },
+    { "rate", 10.0f },
+    { "nativeRate", 1.0f },
+};
+
+// Normalised values to visit, every step of a choice or switch
+std::vector<float> getValues(const juce::RangedAudioParameter& parameter)
+{
+    if (!parameter.isDiscrete())
+        return { 0.0f, 0.5f, 1.0f };
+
+    std::vector<float> values;
+    const auto numSteps = parameter.getNumSteps();
+    for (auto step = 0; step < numSteps; step++)
+        values.push_back(static_cast<float>(step) / static_cast<float>(numSteps - 1));
+    return values;
+}
+
+class Driver {
+public:
+    Driver(double newSampleRate, int newBlockSize)
+        : sampleRate(newSampleRate)
+        , blockSize(newBlockSize)
+        , buffer(numChannels, 2 * newBlockSize + 1)
+    {
+    }
+
+    int run(bool busy)
+    {
+        if (busy) {
+            for (const auto& [id, value] : busyValues) {
+                auto* parameter = processor.getState().getParameter(id);
+                parameter->setValueNotifyingHost(parameter->convertTo0to1(value));
+            }
+        }
+
+        processor.setNonRealtime(true);
+        processor.setRateAndBufferSizeDetails(sampleRate, blockSize);
+        processor.prepareToPlay(sampleRate, blockSize);
+
+        auto numChanges = 0;
+        for (auto* processorParameter : processor.getParameters()) {
+            auto& parameter = *static_cast<juce::RangedAudioParameter*>(processorParameter);
+            const auto initialValue = parameter.getValue();
+            for (auto value : getValues(parameter)) {
+                parameter.setValueNotifyingHost(value);
+                settle();
+                numChanges++;
+            }
+            parameter.setValueNotifyingHost(initialValue);
+            settle();
+        }
+
+        processor.releaseResources();
+        return numChanges;
+    }
+
+private:
+    void settle()
+    {
+        const int lengths[] { blockSize, blockSize / 2 + 1, 2 * blockSize + 1 };
+        const auto numSamples = static_cast<juce::int64>(settleTime_s * sampleRate);
+        auto lengthIndex = 0;
+        for (juce::int64 position = 0; position < numSamples; lengthIndex = (lengthIndex + 1) % 3) {
+            const auto length = lengths[lengthIndex];
+            buffer.setSize(numChannels, length, false, false, true);
+            for (auto channel = 0; channel < numChannels; channel++)
+                for (auto index = 0; index < length; index++)
+                    buffer.setSample(channel, index, 0.5f * std::sin(0.01f * static_cast<float>(position + index + channel)));
+
+            processor.processBlock(buffer, midi);
+            position += length;
+        }
+    }
+
+    double sampleRate;
+    int blockSize;
+    Processor processor;
+    juce::AudioBuffer<float> buffer;
+    juce::MidiBuffer midi;
+};
+
+void selfTest()
+{
+    ScopedAllocationTrap::allowProcessWideEigenTrap();
+    ScopedAllocationTrap allocationTrap;
+    juce::ignoreUnused(allocationTrap);
+    Eigen::VectorXf vector(1024);
+    std::vector<float> values(1024);
+    fmt::print(stderr, "DDS19AllocationCheck: allocations were not trapped ({} {})\n", vector.size(), values.size());
+}
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1) {
+        if (std::string(argv[1]) != "--self-test") {
+            fmt::print(stderr, "Usage: DDS19AllocationCheck [--self-test]\n");
+            return 1;
+        }
+
+        selfTest();
+        return 1;
+    }
+
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    ScopedAllocationTrap::allowProcessWideEigenTrap();
+    if (!ScopedAllocationTrap::trapsEigen()) {
+        fmt::print(stderr, "DDS19AllocationCheck: built without EIGEN_RUNTIME_NO_MALLOC, Eigen allocations cannot be checked\n");
+        return 1;
+    }
+
+    for (auto sampleRate : sampleRates) {
+        for (auto blockSize : blockSizes) {
+            for (auto busy : { false, true }) {
+                Driver driver(sampleRate, blockSize);
+                const auto numChanges = driver.run(busy);
+                fmt::print("{:.0f} Hz, block {}, {}: {} parameter changes\n", sampleRate, blockSize, busy ? "busy" : "defaults", numChanges);
+            }
+        }
+    }
+
+    fmt::print("No allocations on the audio thread\n");
+    return 0;
+}
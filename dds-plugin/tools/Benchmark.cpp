@@ -0,0 +1,324 @@
+// Microbenchmarks for capacity planning and regression tracking: the model
+// engines for each shipped size, the delay line across the COARSE settings and
+// the whole processor across host block sizes and sample rates.
+//
+// Usage: DDS19Benchmark [--seconds <audio seconds per run>] [--runs <count>]
+//                       [--quality <0-2>] [--csv <file>] [--trace <file>]
+//                       [--model-file <binary model>]
+//
+// Every case processes the same amount of audio per run and keeps the fastest
+// run, which is the least disturbed by the rest of the system. Per case:
+//  ns/sample - processing time per sample frame, all channels together
+//  RT factor - audio duration over processing time
+//  inst/core - instances that fit on one core within the load budget
+// --csv writes the same results with one row per case. --trace writes the
+// profiling zones of all runs as Chrome trace JSON, it needs a build with
+// DDS19_PROFILING. Short runs keep the trace within the event buffer.
+// --model-file adds the model cases of a binary model from dds-nn, mapped
+// with ModelFile, and reports how long mapping it took.
+
+#include "DelayLine.h"
+#include "Model.h"
+#include "ModelFile.h"
+#include "Modulator.h"
+#include "Processor.h"
+#include "Profiler.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+// Share of a core an instance may plan for, the same margin the CPU governor
+// keeps (ModelSwitcher::governorThreshold)
+constexpr double loadBudget { 0.7 };
+
+constexpr int numChannels { 2 };
+constexpr double modelSampleRate { 44100.0 };
+constexpr int modelBlockSize { 256 };
+constexpr int numCoarseSettings { 11 };
+constexpr int blockSizes[] { 32, 64, 128, 256, 512, 1024, 2048 };
+constexpr double sampleRates[] { 44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0 };
+
+struct Settings {
+    double seconds { 2.0 };
+    int runs { 5 };
+    int quality { 0 };
+    std::string csvPath;
+    std::string tracePath;
+    std::string modelFilePath;
+};
+
+struct Result {
+    std::string group;
+    std::string name;
+    double sampleRate;
+    int blockSize;
+    double nsPerSample;
+    double realTimeFactor;
+    int instancesPerCore;
+};
+
+// Guitar-like test signal, decaying plucks over a low drone
+float testSignal(int index, double sampleRate)
+{
+    constexpr auto twoPi = juce::MathConstants<double>::twoPi;
+    const auto time = index / sampleRate;
+    const auto pluck = std::fmod(time, 0.5);
+    return static_cast<float>(0.5 * std::exp(-6.0 * pluck) * std::sin(twoPi * 196.0 * time) + 0.1 * std::sin(twoPi * 55.0 * time));
+}
+
+// Runs process over numFrames in blocks of blockSize and returns the fastest
+// of the runs in seconds, after one untimed warm-up run
+template <typename Process>
+double measure(const Settings& settings, int numFrames, int blockSize, Process&& process)
+{
+    auto best = std::numeric_limits<double>::max();
+    for (auto run = 0; run <= settings.runs; run++) {
+        const auto start = std::chrono::steady_clock::now();
+        for (auto frame = 0; frame < numFrames; frame += blockSize)
+            process(std::min(blockSize, numFrames - frame));
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (run > 0)
+            best = std::min(best, elapsed);
+    }
+
+    return best;
+}
+
+Result makeResult(std::string group, std::string name, double sampleRate, int blockSize, int numFrames, double elapsed_s)
+{
+    const auto realTimeFactor = numFrames / sampleRate / elapsed_s;
+    return {
+        std::move(group),
+        std::move(name),
+        sampleRate,
+        blockSize,
+        elapsed_s * 1e9 / numFrames,
+        realTimeFactor,
+        static_cast<int>(loadBudget * realTimeFactor),
+    };
+}
+
+void benchmarkModels(const Settings& settings, std::vector<Result>& results)
+{
+    constexpr const char* modelNames[] { "dds19_lstm32", "dds19_lstm64", "dds19_lstm96" };
+    constexpr const char* modeNames[] { "exact", "fast", "ultraFast" };
+
+    const auto numFrames = static_cast<int>(settings.seconds * modelSampleRate);
+    std::vector<float> input(static_cast<size_t>(numFrames * numChannels));
+    for (auto frame = 0; frame < numFrames; frame++)
+        for (auto channel = 0; channel < numChannels; channel++)
+            input[static_cast<size_t>(frame * numChannels + channel)] = testSignal(frame + channel, modelSampleRate);
+    std::vector<float> output(input.size());
+
+    const auto benchmarkModel = [&](const std::string& name, auto&& createModel) {
+        for (auto mode = 0; mode < 3; mode++) {
+            auto model = createModel();
+            model->prepare(modelBlockSize, numChannels);
+            model->setActivationMode(static_cast<ActivationMode>(mode));
+            model->setConditioning(1.0f, 0.5f);
+
+            auto position = 0;
+            auto elapsed_s = measure(settings, numFrames, modelBlockSize, [&](int numSamples) {
+                position = position + numSamples > numFrames ? 0 : position;
+                model->process(input.data() + position * numChannels, output.data() + position * numChannels, numSamples);
+                position += numSamples;
+            });
+            results.push_back(makeResult("model", fmt::format("{} {}", name, modeNames[mode]), modelSampleRate, modelBlockSize, numFrames, elapsed_s));
+        }
+    };
+
+    for (const auto* modelName : modelNames)
+        benchmarkModel(modelName, [&] { return std::make_unique<Model>(modelName); });
+
+    if (!settings.modelFilePath.empty()) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto modelFile = std::make_shared<const ModelFile>(settings.modelFilePath);
+        const auto elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fmt::print("Mapped {} in {:.1f} us\n", settings.modelFilePath, elapsed_s * 1e6);
+
+        benchmarkModel(juce::File::getCurrentWorkingDirectory().getChildFile(settings.modelFilePath).getFileName().toStdString(), [&] { return std::make_unique<Model>(modelFile); });
+    }
+}
+
+// One delay line with the feedback path of the processor, modulated by the LFO
+void benchmarkDelayLine(const Settings& settings, std::vector<Result>& results)
+{
+    const auto numFrames = static_cast<int>(settings.seconds * modelSampleRate);
+    const auto sampleRateRatio = 1.0f;
+    std::vector<float> input(static_cast<size_t>(numFrames));
+    for (auto frame = 0; frame < numFrames; frame++)
+        input[static_cast<size_t>(frame)] = testSignal(frame, modelSampleRate);
+
+    for (auto coarse = 0; coarse < numCoarseSettings; coarse++) {
+        DelayLine delayLine;
+        delayLine.prepare(modelSampleRate);
+
+        // 8 ms doubled per COARSE step, as in Processor::calculateDelayInSamples
+        delayLine.setDelayInSamples(0.008 * modelSampleRate * std::pow(2.0, coarse) - 1.0, sampleRateRatio);
+
+        Modulator modulator;
+        modulator.setRate(1.0f);
+        modulator.setDepth(0.5f);
+        modulator.prepare(modelSampleRate);
+        std::vector<float> modulation(static_cast<size_t>(modelBlockSize));
+
+        auto position = 0;
+        auto elapsed_s = measure(settings, numFrames, modelBlockSize, [&](int numSamples) {
+            position = position + numSamples > numFrames ? 0 : position;
+            modulator.process(modulation.data(), numSamples);
+            for (auto i = 0; i < numSamples; i++) {
+                auto delayed = delayLine.out(sampleRateRatio, modulation[static_cast<size_t>(i)]);
+                delayLine.in(input[static_cast<size_t>(position + i)] + 0.5f * delayed, sampleRateRatio);
+            }
+            position += numSamples;
+        });
+
+        results.push_back(makeResult("delayLine", fmt::format("coarse {}", coarse), modelSampleRate, modelBlockSize, numFrames, elapsed_s));
+    }
+}
+
+void setParameter(Processor& processor, const char* parameterId, float value)
+{
+    auto* parameter = processor.getState().getParameter(parameterId);
+    parameter->setValueNotifyingHost(parameter->convertTo0to1(value));
+}
+
+void benchmarkProcessor(const Settings& settings, std::vector<Result>& results)
+{
+    for (auto sampleRate : sampleRates) {
+        const auto numFrames = static_cast<int>(settings.seconds * sampleRate);
+        juce::AudioBuffer<float> source(numChannels, numFrames);
+        for (auto channel = 0; channel < numChannels; channel++)
+            for (auto frame = 0; frame < numFrames; frame++)
+                source.setSample(channel, frame, testSignal(frame + channel, sampleRate));
+
+        for (auto blockSize : blockSizes) {
+            Processor processor;
+            setParameter(processor, "quality", static_cast<float>(settings.quality));
+            setParameter(processor, "regen", 0.5f);
+            setParameter(processor, "coarse", 0.5f);
+            setParameter(processor, "rate", 1.0f);
+            setParameter(processor, "depth", 0.5f);
+            processor.setRateAndBufferSizeDetails(sampleRate, blockSize);
+            processor.prepareToPlay(sampleRate, blockSize);
+
+            juce::AudioBuffer<float> buffer(numChannels, blockSize);
+            juce::MidiBuffer midi;
+            auto position = 0;
+            auto elapsed_s = measure(settings, numFrames, blockSize, [&](int numSamples) {
+                position = position + numSamples > numFrames ? 0 : position;
+                buffer.setSize(numChannels, numSamples, false, false, true);
+                for (auto channel = 0; channel < numChannels; channel++)
+                    buffer.copyFrom(channel, 0, source, channel, position, numSamples);
+                processor.processBlock(buffer, midi);
+                position += numSamples;
+            });
+            processor.releaseResources();
+
+            results.push_back(makeResult("processor", fmt::format("quality {}", settings.quality), sampleRate, blockSize, numFrames, elapsed_s));
+        }
+    }
+}
+
+void printResults(const std::vector<Result>& results)
+{
+    fmt::print("\n{:<10} {:<22} {:>9} {:>6} {:>11} {:>10} {:>10}\n", "group", "case", "rate", "block", "ns/sample", "RT factor", "inst/core");
+    for (const auto& result : results) {
+        fmt::print("{:<10} {:<22} {:>9.0f} {:>6} {:>11.1f} {:>10.1f} {:>10}\n", result.group, result.name, result.sampleRate,
+            result.blockSize, result.nsPerSample, result.realTimeFactor, result.instancesPerCore);
+    }
+}
+
+void writeCsv(const std::string& path, const std::vector<Result>& results)
+{
+    std::ofstream file(path);
+    if (!file)
+        throw std::runtime_error("Cannot write " + path);
+
+    file << "group,case,sample_rate,block_size,channels,ns_per_sample,real_time_factor,instances_per_core\n";
+    for (const auto& result : results) {
+        file << fmt::format("{},{},{:.0f},{},{},{:.3f},{:.3f},{}\n", result.group, result.name, result.sampleRate,
+            result.blockSize, numChannels, result.nsPerSample, result.realTimeFactor, result.instancesPerCore);
+    }
+}
+
+Settings parseArguments(int argc, char* argv[])
+{
+    Settings settings;
+    for (auto i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc)
+            throw std::invalid_argument("Missing value for " + arg);
+
+        if (arg == "--seconds")
+            settings.seconds = std::stod(argv[++i]);
+        else if (arg == "--runs")
+            settings.runs = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--quality")
+            settings.quality = std::clamp(std::stoi(argv[++i]), 0, ModelSwitcher::numQualities - 1);
+        else if (arg == "--csv")
+            settings.csvPath = argv[++i];
+        else if (arg == "--trace")
+            settings.tracePath = argv[++i];
+        else if (arg == "--model-file")
+            settings.modelFilePath = argv[++i];
+        else
+            throw std::invalid_argument("Unknown argument " + arg);
+    }
+
+    return settings;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        const auto settings = parseArguments(argc, argv);
+        juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+#if DDS19_PROFILING
+        if (!settings.tracePath.empty())
+            Profiler::start();
+#else
+        if (!settings.tracePath.empty())
+            throw std::invalid_argument("--trace needs a build with DDS19_PROFILING");
+#endif
+
+        std::vector<Result> results;
+        benchmarkModels(settings, results);
+        benchmarkDelayLine(settings, results);
+        benchmarkProcessor(settings, results);
+
+        printResults(results);
+        if (!settings.csvPath.empty())
+            writeCsv(settings.csvPath, results);
+
+#if DDS19_PROFILING
+        if (!settings.tracePath.empty()) {
+            Profiler::stop();
+            if (!Profiler::writeChromeTrace(settings.tracePath))
+                throw std::runtime_error("Cannot write " + settings.tracePath);
+            if (auto dropped = Profiler::getNumDroppedEvents(); dropped > 0)
+                fmt::print("{} trace events did not fit the buffer, use a shorter --seconds\n", dropped);
+        }
+#endif
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "DDS19Benchmark: {}\n"
+                           "Usage: DDS19Benchmark [--seconds <s>] [--runs <count>] [--quality <0-2>] [--csv <file>] [--trace <file>]\n"
+                           "                      [--model-file <file>]\n",
+            e.what());
+        return 1;
+    }
+
+    return 0;
+}
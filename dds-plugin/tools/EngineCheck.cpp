@@ -0,0 +1,303 @@
+// Checks the LSTM and GRU engines against a double precision reference of the
+// PyTorch cells, on random weights in the PyTorch layout converted the way
+// ModelCodegen does. Both the fixed-size kernels and the Eigen::Dynamic
+// fallback run with every activation mode and every form of the recurrent
+// weights (dense, int8 and low-rank), two channels fed different signals and
+// host blocks of varying length, so chunking and per-channel state are covered
+// too.
+//
+// Usage: DDS19EngineCheck
+//
+// Exits with 1 if any case deviates from the reference by more than its
+// activation mode and weight form allow.
+
+#include "Gru.h"
+#include "Lstm.h"
+
+#include <fmt/core.h>
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+constexpr int numChannels { 2 };
+constexpr int numFrames { 4000 };
+constexpr int blockSizes[] { 1, 37, 300, 13 };
+constexpr float sf { 0.7f };
+constexpr float delayFine { -0.2f };
+
+struct Mode {
+    ActivationMode mode;
+    const char* name;
+    double tolerance;
+};
+
+// About ten times the largest error of each mode on these weights, see the
+// approximation errors in Activation.h
+const Mode modes[] {
+    { ActivationMode::exact, "exact", 1e-5 },
+    { ActivationMode::fast, "fast", 2e-4 },
+    { ActivationMode::ultraFast, "ultra fast", 5e-3 },
+};
+
+enum class WeightForm {
+    dense,
+    int8,
+    lowRank
+};
+
+struct Form {
+    WeightForm form;
+    const char* name;
+    double tolerance;
+};
+
+// The reference runs on the dequantized int8 weights and on the product of the
+// low-rank factors, so these only cover the engines' own rounding: the int16
+// hidden state of the int8 path and the two float products of the low-rank
+// path. Added to the mode's tolerance.
+const Form forms[] {
+    { WeightForm::dense, "dense", 0.0 },
+    { WeightForm::int8, "int8", 2e-4 },
+    { WeightForm::lowRank, "low-rank", 1e-5 },
+};
+
+double sigmoid(double x)
+{
+    return 1.0 / (1.0 + std::exp(-x));
+}
+
+// One cell in the PyTorch layout and the same weights as the engines map them
+class TestModel {
+public:
+    TestModel(CellType newCell, WeightForm newForm, Eigen::Index newHiddenSize, std::mt19937& random)
+        : cell(newCell)
+        , form(newForm)
+        , hiddenSize(newHiddenSize)
+        , gateSize((newCell == CellType::gru ? 3 : 4) * newHiddenSize)
+    {
+        // Wider than PyTorch's initialisation, so the gates swing well into
+        // their saturated range
+        const auto scale = 1.0 / std::sqrt(static_cast<double>(hiddenSize));
+        const auto draw = [&](Eigen::Index rows, Eigen::Index cols, double range) {
+            std::uniform_real_distribution<double> distribution(-range, range);
+            return Eigen::MatrixXd::NullaryExpr(rows, cols, [&] { return distribution(random); }).eval();
+        };
+        weightIh = draw(gateSize, 3, 3.0);
+        if (form == WeightForm::lowRank) {
+            // Factors whose product spreads like the dense weights
+            const auto rank = hiddenSize / 4;
+            lowRankU = draw(gateSize, rank, 2.0 * scale);
+            lowRankV = draw(rank, hiddenSize, std::sqrt(3.0 / static_cast<double>(rank)));
+            weightHh = lowRankU * lowRankV;
+        } else {
+            weightHh = draw(gateSize, hiddenSize, 2.0 * scale);
+        }
+        biasIh = draw(gateSize, 1, scale);
+        biasHh = draw(gateSize, 1, scale);
+        linearWeight = draw(1, hiddenSize, 2.0 * scale);
+        linearBias = draw(1, 1, scale).value();
+        convert();
+    }
+
+    RecurrentWeights getWeights() const
+    {
+        RecurrentWeights weights;
+        weights.cellType = cell;
+        weights.weightIh = engineIh.data();
+        if (form == WeightForm::int8) {
+            weights.weightHhInt8 = engineHhInt8.data();
+            weights.weightHhScale = engineHhScale.data();
+        } else if (form == WeightForm::lowRank) {
+            weights.weightHhU = engineHhU.data();
+            weights.weightHhV = engineHhV.data();
+            weights.recurrentRank = engineHhV.rows();
+        } else {
+            weights.weightHh = engineHh.data();
+        }
+        weights.bias = engineBias.data();
+        weights.recurrentBias = cell == CellType::gru ? engineRecurrentBias.data() : nullptr;
+        weights.linearWeight = engineLinearWeight.data();
+        weights.linearBias = engineLinearBias.data();
+        weights.inputSize = 3;
+        weights.hiddenSize = hiddenSize;
+        weights.gateSize = gateSize;
+        weights.outputSize = 1;
+        return weights;
+    }
+
+    std::vector<double> runReference(const std::vector<float>& input) const
+    {
+        std::vector<double> output(input.size());
+        for (auto channel = 0; channel < numChannels; channel++) {
+            Eigen::VectorXd h = Eigen::VectorXd::Zero(hiddenSize);
+            Eigen::VectorXd c = Eigen::VectorXd::Zero(hiddenSize);
+            for (auto frame = 0; frame < numFrames; frame++) {
+                const auto index = static_cast<size_t>(frame * numChannels + channel);
+                const Eigen::Vector3d x(input[index], sf, delayFine);
+                const Eigen::VectorXd gi = weightIh * x + biasIh;
+                const Eigen::VectorXd gh = weightHh * h + biasHh;
+                const auto rows = [&](const Eigen::VectorXd& gates, Eigen::Index gate) {
+                    return gates.segment(gate * hiddenSize, hiddenSize).array();
+                };
+                if (cell == CellType::gru) {
+                    const Eigen::ArrayXd r = (rows(gi, 0) + rows(gh, 0)).unaryExpr(&sigmoid);
+                    const Eigen::ArrayXd z = (rows(gi, 1) + rows(gh, 1)).unaryExpr(&sigmoid);
+                    const Eigen::ArrayXd n = (rows(gi, 2) + r * rows(gh, 2)).tanh();
+                    h = ((1.0 - z) * n + z * h.array()).matrix();
+                } else {
+                    const Eigen::VectorXd g = gi + gh;
+                    const Eigen::ArrayXd i = rows(g, 0).unaryExpr(&sigmoid);
+                    const Eigen::ArrayXd f = rows(g, 1).unaryExpr(&sigmoid);
+                    const Eigen::ArrayXd o = rows(g, 3).unaryExpr(&sigmoid);
+                    c = (f * c.array() + i * rows(g, 2).tanh()).matrix();
+                    h = (o * c.array().tanh()).matrix();
+                }
+                output[index] = (linearWeight * h).value() + linearBias;
+            }
+        }
+        return output;
+    }
+
+private:
+    // Summed biases apart from the GRU new gate, sigmoid rows pre-scaled by 0.5.
+    // int8 weights are quantized per row like ModelCodegen's quantizeRows, and
+    // the reference continues with the dequantized values.
+    void convert()
+    {
+        Eigen::VectorXd bias = biasIh + biasHh;
+        Eigen::MatrixXd ih = weightIh;
+        Eigen::VectorXd hhScale;
+        if (form == WeightForm::int8) {
+            hhScale = (weightHh.rowwise().lpNorm<Eigen::Infinity>().array().max(1e-12) / 127.0).matrix();
+            const Eigen::MatrixXd quantized = (hhScale.asDiagonal().inverse() * weightHh).array().round().max(-127.0).min(127.0).matrix();
+            engineHhInt8 = quantized.cast<std::int8_t>();
+            weightHh = hhScale.asDiagonal() * quantized;
+        }
+        Eigen::MatrixXd hh = weightHh;
+        Eigen::MatrixXd hhU = lowRankU;
+        if (cell == CellType::gru) {
+            bias.tail(hiddenSize) = biasIh.tail(hiddenSize);
+            engineRecurrentBias = biasHh.tail(hiddenSize).cast<float>();
+        }
+
+        const std::vector<Eigen::Index> sigmoidGates = cell == CellType::gru ? std::vector<Eigen::Index> { 0, 1 } : std::vector<Eigen::Index> { 0, 1, 3 };
+        for (auto gate : sigmoidGates) {
+            ih.middleRows(gate * hiddenSize, hiddenSize) *= 0.5;
+            hh.middleRows(gate * hiddenSize, hiddenSize) *= 0.5;
+            if (form == WeightForm::int8)
+                hhScale.segment(gate * hiddenSize, hiddenSize) *= 0.5;
+            else if (form == WeightForm::lowRank)
+                hhU.middleRows(gate * hiddenSize, hiddenSize) *= 0.5;
+            bias.segment(gate * hiddenSize, hiddenSize) *= 0.5;
+        }
+
+        engineIh = ih.cast<float>();
+        engineHh = hh.cast<float>();
+        engineHhScale = hhScale.cast<float>();
+        engineHhU = hhU.cast<float>();
+        engineHhV = lowRankV.cast<float>();
+        engineBias = bias.cast<float>();
+        engineLinearWeight = linearWeight.cast<float>();
+        engineLinearBias = Eigen::VectorXf::Constant(1, static_cast<float>(linearBias));
+    }
+
+    CellType cell;
+    WeightForm form;
+    Eigen::Index hiddenSize;
+    Eigen::Index gateSize;
+
+    Eigen::MatrixXd weightIh;
+    Eigen::MatrixXd weightHh;
+    Eigen::MatrixXd lowRankU;
+    Eigen::MatrixXd lowRankV;
+    Eigen::VectorXd biasIh;
+    Eigen::VectorXd biasHh;
+    Eigen::RowVectorXd linearWeight;
+    double linearBias;
+
+    Eigen::MatrixXf engineIh;
+    Eigen::MatrixXf engineHh;
+    Eigen::Matrix<std::int8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> engineHhInt8;
+    Eigen::VectorXf engineHhScale;
+    Eigen::MatrixXf engineHhU;
+    Eigen::MatrixXf engineHhV;
+    Eigen::VectorXf engineBias;
+    Eigen::VectorXf engineRecurrentBias;
+    Eigen::RowVectorXf engineLinearWeight;
+    Eigen::VectorXf engineLinearBias;
+};
+
+std::vector<float> createInput()
+{
+    std::vector<float> input(numFrames * numChannels);
+    for (auto frame = 0; frame < numFrames; frame++)
+        for (auto channel = 0; channel < numChannels; channel++)
+            input[static_cast<size_t>(frame * numChannels + channel)]
+                = 0.5f * std::sin(0.031f * static_cast<float>(frame) + static_cast<float>(channel))
+                + 0.3f * std::sin(0.0047f * static_cast<float>(frame * (channel + 1)));
+    return input;
+}
+
+double runEngine(RecurrentEngine& engine, const Mode& mode, const std::vector<float>& input, const std::vector<double>& reference)
+{
+    engine.prepare(blockSizes[2], numChannels);
+    engine.setConditioning(sf, delayFine);
+    engine.setActivationMode(mode.mode);
+
+    std::vector<float> output(input.size());
+    auto blockIndex = 0;
+    for (auto start = 0; start < numFrames; blockIndex = (blockIndex + 1) % static_cast<int>(std::size(blockSizes))) {
+        const auto length = std::min(blockSizes[blockIndex], numFrames - start);
+        engine.process(input.data() + start * numChannels, output.data() + start * numChannels, length);
+        start += length;
+    }
+
+    auto maxError = 0.0;
+    for (size_t i = 0; i < output.size(); i++)
+        maxError = std::max(maxError, std::abs(output[i] - reference[i]));
+    return maxError;
+}
+
+template <template <int> class Cell>
+bool check(CellType cellType, const char* name, std::mt19937& random, const std::vector<float>& input)
+{
+    auto passed = true;
+    // 32 runs the fixed-size kernels, 20 the Eigen::Dynamic fallback
+    for (auto hiddenSize : { 32, 20 }) {
+        for (const auto& form : forms) {
+            const TestModel model(cellType, form.form, hiddenSize, random);
+            const auto weights = model.getWeights();
+            const auto reference = model.runReference(input);
+            for (const auto& mode : modes) {
+                std::unique_ptr<RecurrentEngine> engine;
+                if (hiddenSize == 32)
+                    engine = std::make_unique<Cell<32>>(weights);
+                else
+                    engine = std::make_unique<Cell<Eigen::Dynamic>>(weights);
+
+                const auto maxError = runEngine(*engine, mode, input, reference);
+                const auto ok = maxError <= mode.tolerance + form.tolerance;
+                fmt::print("{} {:>2} {:<8}, {:<10}: max error {:.2e} {}\n", name, hiddenSize, form.name, mode.name, maxError, ok ? "ok" : "FAILED");
+                passed = passed && ok;
+            }
+        }
+    }
+    return passed;
+}
+}
+
+int main()
+{
+    std::mt19937 random(19);
+    const auto input = createInput();
+    const auto lstmPassed = check<Lstm>(CellType::lstm, "LSTM", random, input);
+    const auto gruPassed = check<Gru>(CellType::gru, "GRU ", random, input);
+    return lstmPassed && gruPassed ? 0 : 1;
+}
@@ -0,0 +1,305 @@
+// Build step that turns trained JSON models into a header of constexpr weights,
+// so the plugin neither embeds nor parses JSON at runtime.
+//
+// Usage: ModelCodegen [--int8] <output header> <name>=<model json> [<name>=<model json> ...]
+//
+// The weights are written in the layout the inference engines map in place:
+// PyTorch orientation (gates x inputs) in column-major order, the two gate
+// biases summed, and the sigmoid gate rows pre-scaled by 0.5 (see
+// RecurrentWeights in src/RecurrentEngine.h). The cell type follows from the
+// keys of the export, lstm.* or gru.*.
+//
+// The recurrent weights are kept as int8 with per-row scales when the model
+// was exported quantized (store_json(quantize=True) in dds-nn/model.py), or
+// quantized here the same way with --int8. The small input and linear weights
+// of a quantized export are expanded back to float. Exports with a low-rank
+// recurrent factorization (weight_hh_l0.u and .v) keep both factors in float.
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+using StdMatrix = std::vector<std::vector<float>>;
+using StdVector = std::vector<float>;
+
+struct Model {
+    std::string name;
+    std::string cell;
+    StdMatrix weightIh;
+    StdMatrix weightHh;
+    StdVector weightHhScale;
+    StdMatrix weightHhU;
+    StdMatrix weightHhV;
+    StdVector bias;
+    StdVector recurrentBias;
+    StdMatrix linearWeight;
+    StdVector linearBias;
+    size_t hiddenSize { 0 };
+    size_t gateSize { 0 };
+};
+
+StdMatrix loadMatrix(const nlohmann::json& modelJson, const std::string& key)
+{
+    auto matrix = modelJson[key].get<StdMatrix>();
+    if (modelJson.contains(key + ".scale")) {
+        const auto scale = modelJson[key + ".scale"].get<StdVector>();
+        for (size_t row = 0; row < matrix.size(); row++)
+            for (auto& value : matrix[row])
+                value *= scale[row];
+    }
+
+    return matrix;
+}
+
+// Same scheme as quantize_state in dds-nn/model.py
+StdVector quantizeRows(StdMatrix& matrix)
+{
+    StdVector scale;
+    for (auto& row : matrix) {
+        auto maxValue = 1e-12f;
+        for (auto value : row)
+            maxValue = std::max(maxValue, std::abs(value));
+        scale.push_back(maxValue / 127.0f);
+        for (auto& value : row)
+            value = std::clamp(std::nearbyint(value / scale.back()), -127.0f, 127.0f);
+    }
+
+    return scale;
+}
+
+Model loadModel(const std::string& name, const std::string& path, bool quantize)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("Cannot open " + path);
+
+    nlohmann::json modelJson;
+    file >> modelJson;
+
+    Model model;
+    model.name = name;
+    model.cell = modelJson.contains("gru.weight_ih_l0") ? "gru" : "lstm";
+    const auto prefix = model.cell + ".";
+    model.weightIh = loadMatrix(modelJson, prefix + "weight_ih_l0");
+    model.bias = modelJson[prefix + "bias_ih_l0"].get<StdVector>();
+    model.linearWeight = loadMatrix(modelJson, "linear.weight");
+    model.linearBias = modelJson["/linear.bias"_json_pointer].get<StdVector>();
+
+    const auto weightHhKey = prefix + "weight_hh_l0";
+    if (modelJson.contains(weightHhKey + ".u")) {
+        model.weightHhU = modelJson[weightHhKey + ".u"].get<StdMatrix>();
+        model.weightHhV = modelJson[weightHhKey + ".v"].get<StdMatrix>();
+    } else if (modelJson.contains(weightHhKey + ".scale")) {
+        model.weightHh = modelJson[weightHhKey].get<StdMatrix>();
+        model.weightHhScale = modelJson[weightHhKey + ".scale"].get<StdVector>();
+    } else {
+        model.weightHh = loadMatrix(modelJson, weightHhKey);
+        if (quantize)
+            model.weightHhScale = quantizeRows(model.weightHh);
+    }
+
+    model.gateSize = model.weightIh.size();
+    const auto gru = model.cell == "gru";
+    const auto hiddenSize = model.gateSize / (gru ? 3 : 4);
+    model.hiddenSize = hiddenSize;
+
+    // The GRU new gate applies its recurrent bias after the reset gate, so
+    // that part stays separate
+    const auto biasHh = modelJson[prefix + "bias_hh_l0"].get<StdVector>();
+    const auto summedRows = gru ? 2 * hiddenSize : model.gateSize;
+    for (size_t i = 0; i < summedRows; i++)
+        model.bias[i] += biasHh[i];
+    if (gru)
+        model.recurrentBias.assign(biasHh.begin() + static_cast<long>(summedRows), biasHh.end());
+
+    // Sigmoid gates (LSTM input, forget, output, GRU reset, update) are
+    // evaluated as tanh(x / 2)
+    const auto sigmoidGates = gru ? std::vector<size_t> { 0, 1 } : std::vector<size_t> { 0, 1, 3 };
+    for (auto gate : sigmoidGates) {
+        for (auto row = gate * hiddenSize; row < (gate + 1) * hiddenSize; row++) {
+            for (auto& value : model.weightIh[row])
+                value *= 0.5f;
+            if (!model.weightHhU.empty()) {
+                for (auto& value : model.weightHhU[row])
+                    value *= 0.5f;
+            } else if (!model.weightHhScale.empty()) {
+                model.weightHhScale[row] *= 0.5f;
+            } else {
+                for (auto& value : model.weightHh[row])
+                    value *= 0.5f;
+            }
+            model.bias[row] *= 0.5f;
+        }
+    }
+
+    return model;
+}
+
+std::string formatFloat(float value)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.9gf", static_cast<double>(value));
+    return text;
+}
+
+void writeArray(std::ostream& out, const std::string& name, const StdVector& values)
+{
+    out << "    alignas(64) inline constexpr float " << name << "[] = {";
+    for (size_t i = 0; i < values.size(); i++)
+        out << (i % 8 == 0 ? "\n        " : " ") << formatFloat(values[i]) << ",";
+    out << "\n    };\n";
+}
+
+void writeInt8Array(std::ostream& out, const std::string& name, const StdVector& values)
+{
+    out << "    alignas(64) inline constexpr std::int8_t " << name << "[] = {";
+    for (size_t i = 0; i < values.size(); i++)
+        out << (i % 16 == 0 ? "\n        " : " ") << static_cast<int>(values[i]) << ",";
+    out << "\n    };\n";
+}
+
+StdVector rowMajor(const StdMatrix& matrix)
+{
+    StdVector values;
+    for (const auto& row : matrix)
+        values.insert(values.end(), row.begin(), row.end());
+
+    return values;
+}
+
+StdVector columnMajor(const StdMatrix& matrix)
+{
+    StdVector values;
+    for (size_t col = 0; col < matrix[0].size(); col++)
+        for (const auto& row : matrix)
+            values.push_back(row[col]);
+
+    return values;
+}
+
+void writeModel(std::ostream& out, const Model& model)
+{
+    out << "namespace " << model.name << " {\n";
+    out << "    inline constexpr int inputSize { " << model.weightIh[0].size() << " };\n";
+    out << "    inline constexpr int hiddenSize { " << model.hiddenSize << " };\n";
+    out << "    inline constexpr int gateSize { " << model.gateSize << " };\n";
+    out << "    inline constexpr int outputSize { " << model.linearWeight.size() << " };\n";
+    out << "    inline constexpr int recurrentRank { " << model.weightHhV.size() << " };\n";
+    writeArray(out, "weightIh", columnMajor(model.weightIh));
+    if (!model.weightHhU.empty()) {
+        writeArray(out, "weightHhU", columnMajor(model.weightHhU));
+        writeArray(out, "weightHhV", columnMajor(model.weightHhV));
+    } else if (model.weightHhScale.empty()) {
+        writeArray(out, "weightHh", columnMajor(model.weightHh));
+    } else {
+        // Row-major, so each gate row is one contiguous integer dot product
+        writeInt8Array(out, "weightHhInt8", rowMajor(model.weightHh));
+        writeArray(out, "weightHhScale", model.weightHhScale);
+    }
+    writeArray(out, "bias", model.bias);
+    if (!model.recurrentBias.empty())
+        writeArray(out, "recurrentBias", model.recurrentBias);
+    writeArray(out, "linearWeight", columnMajor(model.linearWeight));
+    writeArray(out, "linearBias", model.linearBias);
+    out << "}\n\n";
+}
+}
+
+int main(int argc, char* argv[])
+{
+    auto firstArg = 1;
+    auto quantize = false;
+    if (argc > 1 && std::string(argv[1]) == "--int8") {
+        quantize = true;
+        firstArg++;
+    }
+
+    if (argc < firstArg + 2) {
+        std::cerr << "Usage: ModelCodegen [--int8] <output header> <name>=<model json> ...\n";
+        return 1;
+    }
+
+    const auto* outputPath = argv[firstArg];
+    try {
+        std::vector<Model> models;
+        for (auto i = firstArg + 1; i < argc; i++) {
+            const std::string arg = argv[i];
+            const auto separator = arg.find('=');
+            if (separator == std::string::npos)
+                throw std::runtime_error("Expected <name>=<model json>, got " + arg);
+
+            models.push_back(loadModel(arg.substr(0, separator), arg.substr(separator + 1), quantize));
+        }
+
+        std::ostringstream out;
+        out << "#pragma once\n\n";
+        out << "// Generated by ModelCodegen, do not edit\n\n";
+        out << "#include <cstdint>\n\n";
+        out << "namespace ModelData {\n\n";
+        for (const auto& model : models)
+            writeModel(out, model);
+
+        out << "struct Entry {\n"
+               "    const char* name;\n"
+               "    const char* cell;\n"
+               "    int inputSize;\n"
+               "    int hiddenSize;\n"
+               "    int gateSize;\n"
+               "    int outputSize;\n"
+               "    const float* weightIh;\n"
+               "    const float* weightHh;\n"
+               "    const std::int8_t* weightHhInt8;\n"
+               "    const float* weightHhScale;\n"
+               "    int recurrentRank;\n"
+               "    const float* weightHhU;\n"
+               "    const float* weightHhV;\n"
+               "    const float* bias;\n"
+               "    const float* recurrentBias;\n"
+               "    const float* linearWeight;\n"
+               "    const float* linearBias;\n"
+               "};\n\n";
+        out << "inline constexpr Entry models[] = {\n";
+        for (const auto& model : models) {
+            const auto& n = model.name;
+            const auto factorized = !model.weightHhU.empty();
+            const auto quantized = !factorized && !model.weightHhScale.empty();
+            const auto dense = !factorized && !quantized;
+            auto field = [&n](const std::string& array, bool present) { return present ? n + "::" + array : "nullptr"; };
+            out << "    { \"" << n << "\", \"" << model.cell << "\", " << n << "::inputSize, " << n << "::hiddenSize, " << n << "::gateSize, "
+                << n << "::outputSize, " << n << "::weightIh, " << field("weightHh", dense) << ", "
+                << field("weightHhInt8", quantized) << ", " << field("weightHhScale", quantized) << ", "
+                << n << "::recurrentRank, " << field("weightHhU", factorized) << ", " << field("weightHhV", factorized) << ", "
+                << n << "::bias, " << field("recurrentBias", !model.recurrentBias.empty()) << ", " << n << "::linearWeight, " << n << "::linearBias },\n";
+        }
+        out << "};\n\n";
+        out << "}\n";
+
+        // Only touch the header when it changes to avoid needless rebuilds,
+        // the build tracks this step through a separate stamp file
+        const auto text = out.str();
+        std::ifstream existing(outputPath);
+        std::stringstream existingText;
+        existingText << existing.rdbuf();
+        if (existingText.str() != text) {
+            std::ofstream output(outputPath);
+            output << text;
+            output.close();
+            if (!output)
+                throw std::runtime_error(std::string("Cannot write ") + outputPath);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "ModelCodegen: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,248 @@
+// Offline renderer that streams audio files through the plugin's own Processor,
+// so the result is what the plugin produces in a host, only as fast as the
+// machine allows.
+//
+// Usage: DDS19Render [options] -o <output> <input> [<input> ...]
+//   -o <path>             output file for a single input, otherwise a directory
+//                         that receives one file per input under the same name
+//   --param <id>=<value>  parameter value in its own units, e.g. mix=0.5,
+//                         sf=1 or quality=2 for the third choice
+//   --automation <file>   parameter changes over time, see below
+//   --block <samples>     host block size, default 4096
+//   --tail <seconds>      silence appended to the input to render the repeats
+//
+// Automation files hold one change per line, "<time in seconds> <id> <value>",
+// where # starts a comment. Each change is applied at its exact sample by
+// ending the host block there, from where MIX, REGEN and FINE ramp to the new
+// value as they do in a host. Changes at time 0 take effect before
+// prepareToPlay, like the --param values.
+//
+// The output keeps the sample rate, channel count and bit depth of the input,
+// written as WAV.
+
+#include "Processor.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr int defaultBlockSize { 4096 };
+
+struct ParameterChange {
+    double time_s;
+    std::string id;
+    float value;
+};
+
+struct Settings {
+    std::vector<ParameterChange> changes;
+    int blockSize { defaultBlockSize };
+    double tail_s { 0.0 };
+    juce::File output;
+    std::vector<juce::File> inputs;
+};
+
+ParameterChange parseParameter(const std::string& text)
+{
+    const auto separator = text.find('=');
+    if (separator == std::string::npos)
+        throw std::invalid_argument("Expected <id>=<value>, got " + text);
+
+    return { 0.0, text.substr(0, separator), std::stof(text.substr(separator + 1)) };
+}
+
+std::vector<ParameterChange> loadAutomation(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("Cannot open " + path);
+
+    std::vector<ParameterChange> changes;
+    std::string line;
+    for (auto lineNumber = 1; std::getline(file, line); lineNumber++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        ParameterChange change;
+        if (!(fields >> change.time_s)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+            throw std::runtime_error(fmt::format("{}:{}: expected <time> <id> <value>", path, lineNumber));
+        }
+        if (!(fields >> change.id >> change.value))
+            throw std::runtime_error(fmt::format("{}:{}: expected <time> <id> <value>", path, lineNumber));
+        changes.push_back(change);
+    }
+
+    return changes;
+}
+
+void setParameter(Processor& processor, const ParameterChange& change)
+{
+    auto* parameter = processor.getState().getParameter(change.id);
+    if (parameter == nullptr)
+        throw std::invalid_argument("Unknown parameter " + change.id);
+
+    parameter->setValueNotifyingHost(parameter->convertTo0to1(change.value));
+}
+
+juce::File getOutputFile(const Settings& settings, const juce::File& input)
+{
+    if (settings.inputs.size() == 1 && settings.output.hasFileExtension("wav"))
+        return settings.output;
+
+    if (!settings.output.createDirectory())
+        throw std::runtime_error("Cannot create " + settings.output.getFullPathName().toStdString());
+
+    return settings.output.getChildFile(input.getFileNameWithoutExtension() + ".wav");
+}
+
+void render(const Settings& settings, juce::AudioFormatManager& formatManager, const juce::File& input)
+{
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(input));
+    if (reader == nullptr)
+        throw std::runtime_error("Cannot read " + input.getFullPathName().toStdString());
+
+    const auto output = getOutputFile(settings, input);
+    if (output == input)
+        throw std::runtime_error("Output would overwrite " + input.getFullPathName().toStdString());
+
+    const auto numChannels = static_cast<int>(reader->numChannels);
+    const auto sampleRate = reader->sampleRate;
+
+    Processor processor;
+    juce::AudioProcessor::BusesLayout layout;
+    layout.inputBuses.add(juce::AudioChannelSet::canonicalChannelSet(numChannels));
+    layout.outputBuses.add(juce::AudioChannelSet::canonicalChannelSet(numChannels));
+    if (!processor.setBusesLayout(layout))
+        throw std::runtime_error(fmt::format("{} channels are not supported", numChannels));
+
+    // Changes are sorted by time, the ones at the start apply before preparing
+    std::vector<std::pair<juce::int64, ParameterChange>> changes;
+    for (const auto& change : settings.changes)
+        changes.emplace_back(static_cast<juce::int64>(std::llround(change.time_s * sampleRate)), change);
+    std::stable_sort(changes.begin(), changes.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    size_t nextChange = 0;
+    for (; nextChange < changes.size() && changes[nextChange].first <= 0; nextChange++)
+        setParameter(processor, changes[nextChange].second);
+
+    // Quality changes then take effect at the block they are made in
+    processor.setNonRealtime(true);
+    processor.setRateAndBufferSizeDetails(sampleRate, settings.blockSize);
+    processor.prepareToPlay(sampleRate, settings.blockSize);
+
+    output.deleteFile();
+    auto stream = output.createOutputStream();
+    if (stream == nullptr)
+        throw std::runtime_error("Cannot write " + output.getFullPathName().toStdString());
+
+    const auto bitsPerSample = reader->bitsPerSample > 24 ? 32 : std::max(16, static_cast<int>(reader->bitsPerSample));
+    juce::WavAudioFormat wavFormat;
+    std::unique_ptr<juce::AudioFormatWriter> writer(wavFormat.createWriterFor(stream.get(), sampleRate, static_cast<unsigned int>(numChannels), bitsPerSample, {}, 0));
+    if (writer == nullptr)
+        throw std::runtime_error("Cannot write " + output.getFullPathName().toStdString());
+    stream.release();
+
+    const auto numInputSamples = reader->lengthInSamples;
+    const auto numSamples = numInputSamples + static_cast<juce::int64>(settings.tail_s * sampleRate);
+    juce::AudioBuffer<float> buffer(numChannels, settings.blockSize);
+    juce::MidiBuffer midi;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (juce::int64 position = 0; position < numSamples;) {
+        for (; nextChange < changes.size() && changes[nextChange].first <= position; nextChange++)
+            setParameter(processor, changes[nextChange].second);
+
+        auto blockEnd = std::min(position + settings.blockSize, numSamples);
+        if (nextChange < changes.size())
+            blockEnd = std::min(blockEnd, changes[nextChange].first);
+
+        const auto length = static_cast<int>(blockEnd - position);
+        buffer.setSize(numChannels, length, false, false, true);
+        buffer.clear();
+        if (position < numInputSamples)
+            reader->read(&buffer, 0, static_cast<int>(std::min<juce::int64>(length, numInputSamples - position)), position, true, true);
+
+        processor.processBlock(buffer, midi);
+        writer->writeFromAudioSampleBuffer(buffer, 0, length);
+        position = blockEnd;
+    }
+    processor.releaseResources();
+
+    const auto elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const auto duration_s = static_cast<double>(numSamples) / sampleRate;
+    fmt::print("{} -> {} | {:.1f} s of audio in {:.2f} s | {:.1f}x real time\n", input.getFileName().toStdString(),
+        output.getFullPathName().toStdString(), duration_s, elapsed_s, duration_s / elapsed_s);
+}
+
+Settings parseArguments(int argc, char* argv[])
+{
+    Settings settings;
+    for (auto i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg.size() > 1 && arg[0] == '-' && i + 1 >= argc)
+            throw std::invalid_argument("Missing value for " + arg);
+
+        if (arg == "-o") {
+            settings.output = juce::File::getCurrentWorkingDirectory().getChildFile(argv[++i]);
+        } else if (arg == "--param") {
+            settings.changes.push_back(parseParameter(argv[++i]));
+        } else if (arg == "--automation") {
+            auto automation = loadAutomation(argv[++i]);
+            settings.changes.insert(settings.changes.end(), automation.begin(), automation.end());
+        } else if (arg == "--block") {
+            settings.blockSize = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--tail") {
+            settings.tail_s = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            throw std::invalid_argument("Unknown argument " + arg);
+        } else {
+            settings.inputs.push_back(juce::File::getCurrentWorkingDirectory().getChildFile(arg));
+        }
+    }
+
+    if (settings.inputs.empty() || settings.output == juce::File())
+        throw std::invalid_argument("Expected -o <output> and at least one input");
+
+    return settings;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    Settings settings;
+    try {
+        settings = parseArguments(argc, argv);
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "DDS19Render: {}\n"
+                           "Usage: DDS19Render [--param <id>=<value>] [--automation <file>] [--block <samples>] [--tail <s>]\n"
+                           "                   -o <output> <input> [<input> ...]\n",
+            e.what());
+        return 1;
+    }
+
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    // A failed file does not stop a batch, it only fails the exit code
+    auto numFailed = 0;
+    for (const auto& input : settings.inputs) {
+        try {
+            render(settings, formatManager, input);
+        } catch (const std::exception& e) {
+            fmt::print(stderr, "DDS19Render: {}: {}\n", input.getFileName().toStdString(), e.what());
+            numFailed++;
+        }
+    }
+
+    return numFailed == 0 ? 0 : 1;
+}
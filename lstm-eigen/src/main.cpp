@@ -1,105 +1,533 @@
-#include <AudioFile.h>
-#include <Eigen/Dense>
-#include <nlohmann/json.hpp>
+#include "model.h"
+#include "thread_pool.h"
+#include "wav_file.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cmath>
+#include <filesystem>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 
-float sigmoid(float x)
+namespace fs = std::filesystem;
+
+constexpr auto sf { 1.0f };
+constexpr auto delay_fine { 0.0f };
+
+struct settings {
+    activation_mode mode { activation_mode::exact };
+    bool int8 { false };
+    std::size_t num_jobs { std::max(1u, std::thread::hardware_concurrency()) };
+    std::size_t chunk_frames { 65536 };
+    double segment_seconds { 0.0 };
+    double warmup_seconds { 1.0 };
+    double crossfade_seconds { 0.01 };
+    bool verify { false };
+    bool grid { false };
+    std::string model_path { "../model/dds.json" };
+    fs::path output;
+    std::vector<fs::path> inputs;
+};
+
+struct file_result {
+    std::size_t num_samples { 0 };
+    double length_in_seconds { 0.0 };
+};
+
+void print_usage()
+{
+    std::cout << "Usage: lstm-eigen [--activation exact|fast|ultra-fast] [--int8] [--jobs <n>] [--chunk <frames>]\n"
+                 "                  [--segment <s> [--warmup <s>] [--crossfade <s>] [--verify] | --grid]\n"
+                 "                  [--model <json or bin>] [-o <output> <input file or directory> ...]\n"
+                 "Without inputs renders ../process/input.wav to ../process/output.wav.\n"
+                 "With several inputs or a directory, -o names the output directory.\n"
+                 "--segment splits every file into segments of that length rendered in parallel, each\n"
+                 "starting --warmup seconds early (default 1) and faded into the next over --crossfade\n"
+                 "seconds (default 0.01). --verify also renders serially and reports the difference.\n"
+                 "With --int8 the segments use the int8 weights.\n"
+                 "--grid renders every S/F and DELAY FINE setting of the training dataset in one pass,\n"
+                 "as wet__<S/F>__<FINE>.wav in the -o directory, or in one directory per input.\n";
+}
+
+bool is_wav(const fs::path& path)
+{
+    auto extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    return extension == ".wav";
+}
+
+// Directories expand to the WAV files directly inside them
+std::vector<fs::path> expand_inputs(const std::vector<fs::path>& arguments)
+{
+    std::vector<fs::path> inputs;
+    for (const auto& argument : arguments) {
+        if (!fs::is_directory(argument)) {
+            inputs.push_back(argument);
+            continue;
+        }
+
+        std::vector<fs::path> files;
+        for (const auto& entry : fs::directory_iterator(argument))
+            if (entry.is_regular_file() && is_wav(entry.path()))
+                files.push_back(entry.path());
+        std::sort(files.begin(), files.end());
+        inputs.insert(inputs.end(), files.begin(), files.end());
+    }
+
+    return inputs;
+}
+
+fs::path get_output_path(const settings& settings, const fs::path& input)
+{
+    if (settings.inputs.size() == 1 && !fs::is_directory(settings.output) && is_wav(settings.output))
+        return settings.output;
+
+    fs::create_directories(settings.output);
+    return settings.output / input.filename();
+}
+
+// Buffers and model states of one worker, reused from file to file
+struct worker_state {
+    std::vector<recurrent_state> states;
+    std::vector<recurrent_state> states_int8;
+    batch_state batch;
+    std::vector<float> frames;
+    std::vector<float> input;
+    std::vector<float> rendered;
+    std::vector<float> rendered_int8;
+};
+
+// Streams the file through the model chunk by chunk, every channel with its
+// own state, so memory use does not depend on the file length
+file_result render_file(const settings& settings, const recurrent_model& model, const recurrent_model& model_int8,
+    worker_state& worker, const fs::path& input, const fs::path& output, std::ostream& report)
+{
+    std::error_code error;
+    if (fs::equivalent(input, output, error))
+        throw std::runtime_error("Output would overwrite " + input.string());
+
+    wav_reader reader(input.string());
+    const auto& format = reader.get_format();
+    const auto num_channels = static_cast<std::size_t>(format.num_channels);
+    const auto chunk_frames = settings.chunk_frames;
+    wav_writer writer(output.string(), format, chunk_frames);
+
+    worker.frames.resize(chunk_frames * num_channels);
+    worker.input.resize(chunk_frames);
+    worker.rendered.resize(chunk_frames);
+    worker.rendered_int8.resize(chunk_frames);
+    worker.states.resize(num_channels);
+    worker.states_int8.resize(num_channels);
+    for (std::size_t channel = 0; channel < num_channels; channel++) {
+        worker.states[channel].reset(model, sf, delay_fine);
+        if (settings.int8)
+            worker.states_int8[channel].reset(model_int8, sf, delay_fine);
+    }
+
+    std::chrono::duration<double> duration { 0.0 };
+    std::chrono::duration<double> duration_int8 { 0.0 };
+    auto max_error = 0.0;
+    auto error_energy = 0.0;
+    auto signal_energy = 0.0;
+    for (std::size_t num_frames; (num_frames = reader.read(worker.frames.data(), chunk_frames)) > 0;) {
+        auto* output_frames = writer.get_buffer();
+        for (std::size_t channel = 0; channel < num_channels; channel++) {
+            for (std::size_t i = 0; i < num_frames; i++)
+                worker.input[i] = worker.frames[i * num_channels + channel];
+
+            auto start = std::chrono::steady_clock::now();
+            render(settings.mode, model, worker.states[channel], worker.input.data(), worker.rendered.data(), num_frames);
+            duration += std::chrono::steady_clock::now() - start;
+            const auto* rendered = worker.rendered.data();
+
+            if (settings.int8) {
+                // Same input through the int8 recurrent weights, compared against fp32
+                start = std::chrono::steady_clock::now();
+                render(settings.mode, model_int8, worker.states_int8[channel], worker.input.data(), worker.rendered_int8.data(), num_frames);
+                duration_int8 += std::chrono::steady_clock::now() - start;
+
+                for (std::size_t i = 0; i < num_frames; i++) {
+                    const auto error = static_cast<double>(worker.rendered_int8[i]) - worker.rendered[i];
+                    max_error = std::max(max_error, std::abs(error));
+                    error_energy += error * error;
+                    signal_energy += static_cast<double>(worker.rendered[i]) * worker.rendered[i];
+                }
+                rendered = worker.rendered_int8.data();
+            }
+
+            for (std::size_t i = 0; i < num_frames; i++)
+                output_frames[i * num_channels + channel] = rendered[i];
+        }
+        writer.write(num_frames);
+    }
+    writer.close();
+
+    const auto num_samples = reader.get_num_frames();
+    const auto length_in_seconds = static_cast<double>(num_samples) / format.sample_rate;
+    const auto render_seconds = (settings.int8 ? duration_int8 : duration).count();
+    report << input.filename().string() << " | " << format.bits_per_sample << "-bit @ " << format.sample_rate
+           << " Hz | " << num_channels << " channel(s) | " << length_in_seconds << " sec | rendered in "
+           << render_seconds << " s | " << length_in_seconds / render_seconds << "x real time\n";
+    if (settings.int8) {
+        const auto total = static_cast<double>(num_samples) * num_channels;
+        report << "  int8 vs fp32 | max error " << max_error
+               << " | rms error " << std::sqrt(error_energy / total)
+               << " | SNR " << 10.0 * std::log10(signal_energy / error_energy) << " dB"
+               << " | time " << duration_int8.count() << " s vs " << duration.count() << " s\n";
+    }
+
+    return { num_samples * num_channels, length_in_seconds };
+}
+
+// The S/F x DELAY FINE settings of the training data, see dds-nn/dataset.py
+struct grid_point {
+    int sf;
+    int fine;
+
+    std::string file_name() const
+    {
+        return "wet__" + std::to_string(sf) + "__" + (fine < 10 ? "0" : "") + std::to_string(fine) + ".wav";
+    }
+};
+
+std::vector<grid_point> get_grid()
+{
+    std::vector<grid_point> grid;
+    for (auto sf = 0; sf <= 1; sf++)
+        for (auto fine = 0; fine <= 10; fine++)
+            grid.push_back({ sf, fine });
+
+    return grid;
+}
+
+fs::path get_grid_directory(const settings& settings, const fs::path& input)
+{
+    return settings.inputs.size() == 1 ? settings.output : settings.output / input.stem();
+}
+
+// Reads the input once and renders every grid point from it as one batch of
+// streams, one output file per point
+file_result render_file_grid(const settings& settings, const recurrent_model& model, worker_state& worker,
+    const fs::path& input, const fs::path& output_directory, std::ostream& report)
 {
-    return 1.0f / (1.0f + expf(-x));
+    const auto grid = get_grid();
+    std::vector<std::pair<float, float>> conditioning;
+    for (const auto& point : grid)
+        conditioning.emplace_back(static_cast<float>(point.sf), static_cast<float>(point.fine) / 10.0f);
+
+    wav_reader reader(input.string());
+    const auto& format = reader.get_format();
+    const auto num_channels = static_cast<std::size_t>(format.num_channels);
+    const auto num_points = grid.size();
+    const auto num_streams = num_channels * num_points;
+    const auto chunk_frames = settings.chunk_frames;
+
+    fs::create_directories(output_directory);
+    std::vector<std::unique_ptr<wav_writer>> writers;
+    for (const auto& point : grid) {
+        const auto output = output_directory / point.file_name();
+        std::error_code error;
+        if (fs::equivalent(input, output, error))
+            throw std::runtime_error("Output would overwrite " + input.string());
+        writers.push_back(std::make_unique<wav_writer>(output.string(), format, chunk_frames));
+    }
+
+    worker.batch.reset(model, conditioning, static_cast<Eigen::Index>(num_channels));
+    worker.frames.resize(chunk_frames * num_channels);
+    worker.rendered.resize(chunk_frames * num_streams);
+
+    std::chrono::duration<double> duration { 0.0 };
+    for (std::size_t num_frames; (num_frames = reader.read(worker.frames.data(), chunk_frames)) > 0;) {
+        const auto start = std::chrono::steady_clock::now();
+        render_batch(settings.mode, model, worker.batch, worker.frames.data(), num_frames, worker.rendered.data());
+        duration += std::chrono::steady_clock::now() - start;
+
+        for (std::size_t point = 0; point < num_points; point++) {
+            auto* output_frames = writers[point]->get_buffer();
+            for (std::size_t i = 0; i < num_frames; i++)
+                for (std::size_t channel = 0; channel < num_channels; channel++)
+                    output_frames[i * num_channels + channel] = worker.rendered[i * num_streams + channel * num_points + point];
+            writers[point]->write(num_frames);
+        }
+    }
+    for (auto& writer : writers)
+        writer->close();
+
+    const auto num_samples = reader.get_num_frames();
+    const auto length_in_seconds = static_cast<double>(num_samples) / format.sample_rate;
+    report << input.filename().string() << " | " << format.bits_per_sample << "-bit @ " << format.sample_rate
+           << " Hz | " << num_channels << " channel(s) | " << length_in_seconds << " sec | " << num_points
+           << " grid points rendered in " << duration.count() << " s | " << length_in_seconds / duration.count()
+           << "x real time for the grid, " << length_in_seconds * static_cast<double>(num_points) / duration.count()
+           << "x per point\n";
+
+    return { num_samples * num_streams, length_in_seconds * static_cast<double>(num_points) };
 }
 
-Eigen::MatrixXf to_eigen(const std::vector<std::vector<float>>& values)
+// Renders frames [first, last) of the file, continuing the per-channel
+// states, and keeps the frames from output_start on, interleaved
+void render_range(const settings& settings, const recurrent_model& model, const wav_reader& reader, std::vector<recurrent_state>& states,
+    worker_state& worker, std::size_t first, std::size_t last, std::size_t output_start, float* output)
 {
-    auto rows = values.size();
-    auto cols = values[0].size();
-    auto mat = Eigen::MatrixXf(rows, cols);
-    for (auto row = 0; row < rows; row++)
-        for (auto col = 0; col < cols; col++)
-            mat(row, col) = values[row][col];
-
-    return mat;
+    const auto num_channels = states.size();
+    const auto chunk_frames = settings.chunk_frames;
+    worker.frames.resize(chunk_frames * num_channels);
+    worker.input.resize(chunk_frames);
+    worker.rendered.resize(chunk_frames);
+    for (auto position = first; position < last;) {
+        const auto num_frames = reader.read(position, worker.frames.data(), std::min(chunk_frames, last - position));
+        if (num_frames == 0)
+            break;
+
+        for (std::size_t channel = 0; channel < num_channels; channel++) {
+            for (std::size_t i = 0; i < num_frames; i++)
+                worker.input[i] = worker.frames[i * num_channels + channel];
+            render(settings.mode, model, states[channel], worker.input.data(), worker.rendered.data(), num_frames);
+            for (auto i = std::max(position, output_start) - position; i < num_frames; i++)
+                output[(position + i - output_start) * num_channels + channel] = worker.rendered[i];
+        }
+        position += num_frames;
+    }
 }
 
-Eigen::RowVectorXf to_eigen(const std::vector<float>& values)
+void write_frames(wav_writer& writer, const float* frames, std::size_t num_frames, std::size_t chunk_frames)
 {
-    auto rows = values.size();
-    auto vec = Eigen::RowVectorXf(rows);
-    for (auto row = 0; row < rows; row++)
-        vec(row) = values[row];
+    const auto num_channels = static_cast<std::size_t>(writer.get_format().num_channels);
+    for (std::size_t position = 0; position < num_frames; position += chunk_frames) {
+        const auto count = std::min(chunk_frames, num_frames - position);
+        std::copy_n(frames + position * num_channels, count * num_channels, writer.get_buffer());
+        writer.write(count);
+    }
+}
+
+// Splits the file into segments rendered side by side on the pool, for long
+// files that would otherwise keep one core busy. Every segment starts from a
+// reset state warmup frames early and runs crossfade frames past its end,
+// over which it fades into the next segment. The pool renders one window of
+// segments at a time, so memory use stays bounded.
+file_result render_file_segmented(const settings& settings, const recurrent_model& model, work_stealing_pool& pool,
+    std::vector<worker_state>& workers, const fs::path& input, const fs::path& output, std::ostream& report)
+{
+    std::error_code error;
+    if (fs::equivalent(input, output, error))
+        throw std::runtime_error("Output would overwrite " + input.string());
+
+    const auto start_time = std::chrono::steady_clock::now();
+    const wav_reader reader(input.string());
+    const auto& format = reader.get_format();
+    const auto num_channels = static_cast<std::size_t>(format.num_channels);
+    const auto num_frames = reader.get_num_frames();
+    wav_writer writer(output.string(), format, settings.chunk_frames);
+
+    const auto to_frames = [&](double seconds) { return static_cast<std::size_t>(std::llround(seconds * format.sample_rate)); };
+    const auto segment_frames = std::max<std::size_t>(1, to_frames(settings.segment_seconds));
+    const auto warmup_frames = to_frames(settings.warmup_seconds);
+    const auto crossfade_frames = std::min(segment_frames, to_frames(settings.crossfade_seconds));
+
+    std::vector<std::vector<float>> segments(pool.size());
+    std::vector<float> carry;
+
+    // The serial render for --verify continues across windows
+    std::vector<recurrent_state> serial_states(num_channels);
+    for (auto& state : serial_states)
+        state.reset(model, sf, delay_fine);
+    std::vector<float> serial;
+    auto max_error = 0.0;
+    auto error_energy = 0.0;
+    auto signal_energy = 0.0;
 
-    return vec;
+    const auto window_frames = segments.size() * segment_frames;
+    for (std::size_t window = 0; window < num_frames; window += window_frames) {
+        const auto window_end = std::min(num_frames, window + window_frames);
+        const auto num_segments = (window_end - window + segment_frames - 1) / segment_frames;
+        for (std::size_t k = 0; k < num_segments; k++) {
+            pool.submit([&, k, window](std::size_t worker) {
+                const auto start = window + k * segment_frames;
+                const auto end = std::min(num_frames, start + segment_frames + crossfade_frames);
+                auto& states = workers[worker].states;
+                states.resize(num_channels);
+                for (auto& state : states)
+                    state.reset(model, sf, delay_fine);
+                segments[k].resize((end - start) * num_channels);
+                render_range(settings, model, reader, states, workers[worker], start - std::min(start, warmup_frames), end, start, segments[k].data());
+            });
+        }
+        if (settings.verify) {
+            pool.submit([&, window, window_end](std::size_t worker) {
+                serial.resize((window_end - window) * num_channels);
+                render_range(settings, model, reader, serial_states, workers[worker], window, window_end, window, serial.data());
+            });
+        }
+        pool.wait();
+
+        for (std::size_t k = 0; k < num_segments; k++) {
+            auto& segment = segments[k];
+            const auto start = window + k * segment_frames;
+            const auto length = std::min(segment_frames, num_frames - start);
+
+            // Fade in from the run of the segment before past its end
+            const auto fade_samples = std::min(carry.size(), segment.size());
+            const auto fade_frames = fade_samples / num_channels;
+            for (std::size_t i = 0; i < fade_samples; i++) {
+                const auto gain = (static_cast<float>(i / num_channels) + 0.5f) / static_cast<float>(fade_frames);
+                segment[i] = carry[i] + gain * (segment[i] - carry[i]);
+            }
+            carry.assign(segment.begin() + static_cast<std::ptrdiff_t>(length * num_channels), segment.end());
+
+            if (settings.verify) {
+                const auto* reference = serial.data() + (start - window) * num_channels;
+                for (std::size_t i = 0; i < length * num_channels; i++) {
+                    const auto error = static_cast<double>(segment[i]) - reference[i];
+                    max_error = std::max(max_error, std::abs(error));
+                    error_energy += error * error;
+                    signal_energy += static_cast<double>(reference[i]) * reference[i];
+                }
+            }
+
+            write_frames(writer, segment.data(), length, settings.chunk_frames);
+        }
+    }
+    writer.close();
+
+    const auto length_in_seconds = static_cast<double>(num_frames) / format.sample_rate;
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    report << input.filename().string() << " | " << format.bits_per_sample << "-bit @ " << format.sample_rate
+           << " Hz | " << num_channels << " channel(s) | " << length_in_seconds << " sec | "
+           << (num_frames + segment_frames - 1) / segment_frames << " segment(s) of " << settings.segment_seconds
+           << " s, warm-up " << settings.warmup_seconds << " s, crossfade " << settings.crossfade_seconds
+           << " s | rendered in " << elapsed << " s | " << length_in_seconds / elapsed << "x real time\n";
+    if (settings.verify) {
+        const auto total = static_cast<double>(num_frames) * num_channels;
+        report << "  divergence from serial | max error " << max_error
+               << " | rms error " << std::sqrt(error_energy / total)
+               << " | SNR " << 10.0 * std::log10(signal_energy / error_energy) << " dB\n";
+    }
+
+    return { num_frames * num_channels, length_in_seconds };
 }
 
-int main()
+int main(int argc, char* argv[])
 {
-    // Load the model
-    std::ifstream model_json_file("../model/dds.json");
-    nlohmann::json model_json;
-    model_json_file >> model_json;
-
-    // Model
-    auto lstm_weight_ih = to_eigen(model_json["/lstm.weight_ih_l0"_json_pointer].get<std::vector<std::vector<float>>>());
-    auto lstm_weight_hh = to_eigen(model_json["/lstm.weight_hh_l0"_json_pointer].get<std::vector<std::vector<float>>>());
-    auto lstm_bias_ih = to_eigen(model_json["/lstm.bias_ih_l0"_json_pointer].get<std::vector<float>>());
-    auto lstm_bias_hh = to_eigen(model_json["/lstm.bias_hh_l0"_json_pointer].get<std::vector<float>>());
-    auto linear_weight = to_eigen(model_json["/linear.weight"_json_pointer].get<std::vector<std::vector<float>>>());
-    auto linear_bias = to_eigen(model_json["/linear.bias"_json_pointer].get<std::vector<float>>());
-
-    auto input_size = lstm_weight_ih.cols();
-    auto output_size = linear_weight.cols();
-    auto gate_size = lstm_weight_ih.rows();
-    auto hidden_size = gate_size / 4;
-
-    // Load audio file
-    AudioFile<float> input_audio("../process/input.wav");
-    auto sample_rate = input_audio.getSampleRate();
-    auto bit_depth = input_audio.getBitDepth();
-    auto num_samples = input_audio.getNumSamplesPerChannel();
-    auto num_channels = input_audio.getNumChannels();
-    auto length_in_seconds = input_audio.getLengthInSeconds();
-    std::cout << "Audio: " << bit_depth << "-bit @ " << sample_rate << " Hz | " << num_channels
-              << " channel(s) | " << length_in_seconds << " sec | " << num_samples << " samples\n";
-
-    constexpr auto channel { 0 };
-    constexpr auto sf { 1.0f };
-    constexpr auto delay_fine { 0.0f };
-
-    AudioFile<float> output_file;
-    output_file.setNumChannels(num_channels);
-    output_file.setNumSamplesPerChannel(num_samples);
-    output_file.setBitDepth(bit_depth);
-    output_file.setSampleRate(sample_rate);
-
-    auto input = Eigen::RowVectorXf(input_size).setZero();
-    auto output = Eigen::RowVectorXf(output_size).setZero();
-    auto gates = Eigen::RowVectorXf(gate_size).setZero();
-    auto c = Eigen::RowVectorXf(hidden_size).setZero();
-    auto h = Eigen::RowVectorXf(hidden_size).setZero();
-
-    std::cout << "Processing...\n";
-    auto start = std::chrono::high_resolution_clock::now();
-    auto idx = 0;
-    for (const auto& sample : input_audio.samples[channel]) {
-        input[0] = sample;
-        input[1] = sf;
-        input[2] = delay_fine;
-
-        // LSTM
-        gates = input * lstm_weight_ih.transpose() + lstm_bias_ih + h * lstm_weight_hh.transpose() + lstm_bias_hh;
-        for (auto i = 0; i < hidden_size; i++) {
-            c[i] = sigmoid(gates[hidden_size + i]) * c[i] + sigmoid(gates[i]) * tanhf(gates[2 * hidden_size + i]);
-            h[i] = sigmoid(gates[3 * hidden_size + i]) * tanhf(c[i]);
+    // Parse arguments
+    settings settings;
+    try {
+        for (auto i = 1; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--activation" && i + 1 < argc) {
+                settings.mode = parse_activation_mode(argv[++i]);
+            } else if (arg == "--int8") {
+                settings.int8 = true;
+            } else if (arg == "--jobs" && i + 1 < argc) {
+                settings.num_jobs = static_cast<std::size_t>(std::max(1, std::stoi(argv[++i])));
+            } else if (arg == "--chunk" && i + 1 < argc) {
+                settings.chunk_frames = static_cast<std::size_t>(std::max(1, std::stoi(argv[++i])));
+            } else if (arg == "--segment" && i + 1 < argc) {
+                settings.segment_seconds = std::max(0.0, std::stod(argv[++i]));
+            } else if (arg == "--warmup" && i + 1 < argc) {
+                settings.warmup_seconds = std::max(0.0, std::stod(argv[++i]));
+            } else if (arg == "--crossfade" && i + 1 < argc) {
+                settings.crossfade_seconds = std::max(0.0, std::stod(argv[++i]));
+            } else if (arg == "--verify") {
+                settings.verify = true;
+            } else if (arg == "--grid") {
+                settings.grid = true;
+            } else if (arg == "--model" && i + 1 < argc) {
+                settings.model_path = argv[++i];
+            } else if (arg == "-o" && i + 1 < argc) {
+                settings.output = argv[++i];
+            } else if (!arg.empty() && arg[0] != '-') {
+                settings.inputs.emplace_back(arg);
+            } else {
+                print_usage();
+                return arg == "--help" ? 0 : 1;
+            }
         }
 
-        // Linear
-        output = h * linear_weight.transpose() + linear_bias;
-        output_file.samples[channel][idx++] = output.value();
+        if (settings.grid && (settings.int8 || settings.segment_seconds > 0.0))
+            throw std::invalid_argument("--grid renders fp32 in one pass, without --int8 or --segment");
+
+        if (settings.inputs.empty()) {
+            settings.inputs = { "../process/input.wav" };
+            settings.output = settings.grid ? "../process/grid" : "../process/output.wav";
+        } else if (settings.output.empty()) {
+            throw std::invalid_argument("Expected -o <output>");
+        }
+        settings.inputs = expand_inputs(settings.inputs);
+    } catch (const std::exception& e) {
+        std::cerr << "lstm-eigen: " << e.what() << "\n";
+        print_usage();
+        return 1;
     }
-    auto stop = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
 
-    output_file.save("../process/output.wav");
-    std::cout << "Finished in " << duration.count() << " seconds\n";
-}
\ No newline at end of file
+    // One read-only copy of the weights shared by all workers
+    const auto model = load_model(settings.model_path);
+    const auto model_int8 = settings.int8 ? quantize_model(model) : recurrent_model {};
+
+    // Workers run their own jobs last in first out, so submitting the shortest
+    // files first starts the long ones early and leaves the short ones to fill
+    // the gaps at the end
+    auto inputs = settings.inputs;
+    std::stable_sort(inputs.begin(), inputs.end(), [](const auto& a, const auto& b) {
+        std::error_code error;
+        return fs::file_size(a, error) < fs::file_size(b, error);
+    });
+
+    // Segmented files use the whole pool one after the other, otherwise every
+    // file is a job of its own
+    const auto segmented = settings.segment_seconds > 0.0;
+    work_stealing_pool pool(segmented ? settings.num_jobs : std::min(settings.num_jobs, inputs.size()));
+    std::vector<worker_state> workers(pool.size());
+    std::mutex report_mutex;
+    std::atomic<std::size_t> total_samples { 0 };
+    std::atomic<int> num_failed { 0 };
+    double total_seconds { 0.0 };
+
+    const auto render_input = [&](const fs::path& input, const auto& render) {
+        std::ostringstream report;
+        try {
+            const auto result = render(report);
+            total_samples += result.num_samples;
+            std::lock_guard<std::mutex> lock(report_mutex);
+            total_seconds += result.length_in_seconds;
+            std::cout << report.str();
+        } catch (const std::exception& e) {
+            // A failed file does not stop the batch, it only fails the exit code
+            num_failed++;
+            std::lock_guard<std::mutex> lock(report_mutex);
+            std::cerr << "lstm-eigen: " << input.string() << ": " << e.what() << "\n";
+        }
+    };
+
+    std::cout << "Processing " << inputs.size() << " file(s) on " << pool.size() << " thread(s)...\n";
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& input : inputs) {
+        if (segmented) {
+            render_input(input, [&](std::ostream& report) {
+                return render_file_segmented(settings, settings.int8 ? model_int8 : model, pool, workers, input, get_output_path(settings, input), report);
+            });
+        } else if (settings.grid) {
+            pool.submit([&, input](std::size_t worker) {
+                render_input(input, [&](std::ostream& report) {
+                    return render_file_grid(settings, model, workers[worker], input, get_grid_directory(settings, input), report);
+                });
+            });
+        } else {
+            pool.submit([&, input](std::size_t worker) {
+                render_input(input, [&](std::ostream& report) {
+                    return render_file(settings, model, model_int8, workers[worker], input, get_output_path(settings, input), report);
+                });
+            });
+        }
+    }
+    pool.wait();
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Finished in " << elapsed << " seconds | " << static_cast<double>(total_samples) / elapsed
+              << " samples/s | " << total_seconds / elapsed << "x real time overall\n";
+
+    return num_failed == 0 ? 0 : 1;
+}
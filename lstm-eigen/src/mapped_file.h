@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory map of a whole file. Pages are read in by the OS as they
+// are touched, so only the part of the file being worked on takes memory.
+class mapped_file {
+public:
+    explicit mapped_file(const std::string& path)
+    {
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER file_size;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size))
+            throw std::runtime_error("Cannot open " + path);
+
+        length = static_cast<std::size_t>(file_size.QuadPart);
+        if (length > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr)
+                address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (address == nullptr)
+                throw std::runtime_error("Cannot map " + path);
+        }
+#else
+        const auto descriptor = ::open(path.c_str(), O_RDONLY);
+        struct stat status;
+        if (descriptor < 0 || ::fstat(descriptor, &status) != 0) {
+            if (descriptor >= 0)
+                ::close(descriptor);
+            throw std::runtime_error("Cannot open " + path);
+        }
+
+        length = static_cast<std::size_t>(status.st_size);
+        if (length > 0) {
+            address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (address == MAP_FAILED)
+                address = nullptr;
+        }
+        ::close(descriptor);
+
+        if (length > 0 && address == nullptr)
+            throw std::runtime_error("Cannot map " + path);
+#endif
+    }
+
+    ~mapped_file()
+    {
+#if defined(_WIN32)
+        if (address != nullptr)
+            UnmapViewOfFile(address);
+        if (mapping != nullptr)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (address != nullptr)
+            ::munmap(address, length);
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    const unsigned char* data() const { return static_cast<const unsigned char*>(address); }
+    std::size_t size() const { return length; }
+
+    // Starts reading a range in the background, ahead of its use
+    void prefetch(std::size_t offset, std::size_t count) const
+    {
+        advise(offset, count, will_need);
+    }
+
+    // Gives back the pages of a range that will not be read again
+    void release(std::size_t offset, std::size_t count) const
+    {
+        advise(offset, count, dont_need);
+    }
+
+private:
+#if defined(_WIN32)
+    static constexpr int will_need { 0 };
+    static constexpr int dont_need { 0 };
+
+    void advise(std::size_t, std::size_t, int) const { }
+
+    HANDLE file { INVALID_HANDLE_VALUE };
+    HANDLE mapping { nullptr };
+#else
+    static constexpr int will_need { MADV_WILLNEED };
+    static constexpr int dont_need { MADV_DONTNEED };
+
+    // madvise works on whole pages, so the range is widened to them
+    void advise(std::size_t offset, std::size_t count, int advice) const
+    {
+        if (address == nullptr || count == 0 || offset >= length)
+            return;
+
+        static const auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        const auto begin = offset / page_size * page_size;
+        const auto end = std::min(length, offset + count);
+        ::madvise(static_cast<char*>(address) + begin, end - begin, advice);
+    }
+#endif
+
+    void* address { nullptr };
+    std::size_t length { 0 };
+};
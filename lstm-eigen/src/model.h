@@ -0,0 +1,456 @@
+#pragma once
+
+#include "activation.h"
+#include "mapped_file.h"
+#include "quantize.h"
+
+#include <Eigen/Dense>
+#include <nlohmann/json.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+inline Eigen::MatrixXf to_eigen(const std::vector<std::vector<float>>& values)
+{
+    auto rows = values.size();
+    auto cols = values[0].size();
+    auto mat = Eigen::MatrixXf(rows, cols);
+    for (auto row = 0; row < rows; row++)
+        for (auto col = 0; col < cols; col++)
+            mat(row, col) = values[row][col];
+
+    return mat;
+}
+
+inline Eigen::RowVectorXf to_eigen(const std::vector<float>& values)
+{
+    auto rows = values.size();
+    auto vec = Eigen::RowVectorXf(rows);
+    for (auto row = 0; row < rows; row++)
+        vec(row) = values[row];
+
+    return vec;
+}
+
+// Quantized exports (store_json(quantize=True) in dds-nn/model.py) hold int8
+// values with one "<key>.scale" per row, which are dequantized here
+inline Eigen::MatrixXf load_matrix(const nlohmann::json& model_json, const std::string& key)
+{
+    Eigen::MatrixXf matrix = to_eigen(model_json[key].get<std::vector<std::vector<float>>>());
+    if (model_json.contains(key + ".scale"))
+        matrix.array().colwise() *= to_eigen(model_json[key + ".scale"].get<std::vector<float>>()).transpose().array();
+
+    return matrix;
+}
+
+using row_major_matrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+// Single layer LSTM or GRU followed by a linear layer. Read only once loaded,
+// so any number of threads can render with the same model.
+//
+// The weights are views on storage the model shares: the arrays read from a
+// JSON export (lstm.* or gru.* keys) or a mapped binary model file. Products
+// are taken with the state as a row vector, so the matrices are inputs x gates.
+struct recurrent_model {
+    using matrix_view = Eigen::Map<const row_major_matrix, Eigen::Aligned16>;
+    using vector_view = Eigen::Map<const Eigen::RowVectorXf, Eigen::Aligned16>;
+
+    bool gru { false };
+    matrix_view weight_ih { nullptr, 0, 0 };
+    matrix_view weight_hh { nullptr, 0, 0 };
+    vector_view bias { nullptr, 0 };
+
+    // GRU only: zero except for the new gate's recurrent bias, which is
+    // scaled by the reset gate and so cannot be folded into bias
+    vector_view recurrent_bias { nullptr, 0 };
+
+    matrix_view linear_weight { nullptr, 0, 0 };
+    vector_view linear_bias { nullptr, 0 };
+
+    // Optional int8 copy of weight_hh, one row per gate
+    quantized_matrix weight_hh_int8;
+    bool int8 { false };
+
+    // Keeps the storage behind the views alive
+    std::shared_ptr<const void> storage;
+};
+
+// Eigen maps are re-pointed by constructing them again in place
+template <typename View, typename... Args>
+void set_view(View& view, Args... args)
+{
+    new (&view) View(args...);
+}
+
+inline recurrent_model load_model_json(const std::string& path)
+{
+    std::ifstream model_json_file(path);
+    if (!model_json_file)
+        throw std::runtime_error("Cannot open " + path);
+
+    nlohmann::json model_json;
+    model_json_file >> model_json;
+
+    const auto gru = model_json.contains("gru.weight_ih_l0");
+    const std::string prefix = gru ? "gru." : "lstm.";
+    Eigen::MatrixXf weight_ih = load_matrix(model_json, prefix + "weight_ih_l0").transpose();
+
+    // Factorized exports (RECURRENT_RANK in dds-nn/train.py) replace weight_hh
+    // by its low-rank factors, which are multiplied back out here
+    const auto weight_hh_key = prefix + "weight_hh_l0";
+    Eigen::MatrixXf weight_hh;
+    if (model_json.contains(weight_hh_key + ".u"))
+        weight_hh = (load_matrix(model_json, weight_hh_key + ".u") * load_matrix(model_json, weight_hh_key + ".v")).transpose();
+    else
+        weight_hh = load_matrix(model_json, weight_hh_key).transpose();
+
+    Eigen::RowVectorXf bias = to_eigen(model_json[prefix + "bias_ih_l0"].get<std::vector<float>>());
+    const auto bias_hh = to_eigen(model_json[prefix + "bias_hh_l0"].get<std::vector<float>>());
+    Eigen::RowVectorXf recurrent_bias;
+
+    auto hidden_size = weight_hh.rows();
+    if (gru) {
+        // The new gate's recurrent bias stays behind the reset gate
+        bias.head(2 * hidden_size) += bias_hh.head(2 * hidden_size);
+        recurrent_bias = Eigen::RowVectorXf::Zero(bias_hh.size());
+        recurrent_bias.tail(hidden_size) = bias_hh.tail(hidden_size);
+    } else {
+        bias += bias_hh;
+    }
+
+    // Sigmoid gates (LSTM input, forget, output, GRU reset, update) are
+    // evaluated as tanh(x / 2)
+    const auto sigmoid_gates = gru ? std::vector<int> { 0, 1 } : std::vector<int> { 0, 1, 3 };
+    for (auto gate : sigmoid_gates) {
+        weight_ih.middleCols(gate * hidden_size, hidden_size) *= 0.5f;
+        weight_hh.middleCols(gate * hidden_size, hidden_size) *= 0.5f;
+        bias.segment(gate * hidden_size, hidden_size) *= 0.5f;
+    }
+
+    struct json_weights {
+        row_major_matrix weight_ih;
+        row_major_matrix weight_hh;
+        Eigen::RowVectorXf bias;
+        Eigen::RowVectorXf recurrent_bias;
+        row_major_matrix linear_weight;
+        Eigen::RowVectorXf linear_bias;
+    };
+    auto weights = std::make_shared<json_weights>();
+    weights->weight_ih = weight_ih;
+    weights->weight_hh = weight_hh;
+    weights->bias = bias;
+    weights->recurrent_bias = recurrent_bias;
+    weights->linear_weight = load_matrix(model_json, "linear.weight").transpose();
+    weights->linear_bias = to_eigen(model_json["/linear.bias"_json_pointer].get<std::vector<float>>());
+
+    recurrent_model model;
+    model.gru = gru;
+    set_view(model.weight_ih, weights->weight_ih.data(), weights->weight_ih.rows(), weights->weight_ih.cols());
+    set_view(model.weight_hh, weights->weight_hh.data(), weights->weight_hh.rows(), weights->weight_hh.cols());
+    set_view(model.bias, weights->bias.data(), weights->bias.size());
+    set_view(model.recurrent_bias, weights->recurrent_bias.data(), weights->recurrent_bias.size());
+    set_view(model.linear_weight, weights->linear_weight.data(), weights->linear_weight.rows(), weights->linear_weight.cols());
+    set_view(model.linear_bias, weights->linear_bias.data(), weights->linear_bias.size());
+    model.storage = weights;
+    return model;
+}
+
+// Binary model written by store_binary in dds-nn/model.py, which holds the
+// weights prepared the same way as above. The file is mapped and its blocks
+// are used in place, without parsing or copying. Its column-major gates x
+// inputs matrices are the row-major inputs x gates matrices used here.
+// Quantized and low-rank recurrent weights are expanded to a float copy.
+inline recurrent_model load_model_binary(const std::string& path)
+{
+    constexpr std::size_t header_size { 64 };
+    constexpr std::size_t entry_size { 64 };
+    constexpr std::uint32_t version { 1 };
+    enum block_type : std::uint32_t { float32,
+        int8 };
+
+    auto file = std::make_shared<mapped_file>(path);
+    const auto* bytes = file->data();
+    const auto read_u32 = [&](std::size_t offset) {
+        std::uint32_t value;
+        std::memcpy(&value, bytes + offset, sizeof(value));
+        return value;
+    };
+    const auto read_u64 = [&](std::size_t offset) {
+        std::uint64_t value;
+        std::memcpy(&value, bytes + offset, sizeof(value));
+        return value;
+    };
+
+    if (file->size() < header_size || std::memcmp(bytes, "DDS19MDL", 8) != 0)
+        throw std::runtime_error(path + " is not a binary model");
+    if (read_u32(8) != version)
+        throw std::runtime_error(path + " has unsupported model version " + std::to_string(read_u32(8)));
+    if (read_u32(12) > 1)
+        throw std::runtime_error(path + " has an unknown cell type");
+
+    const auto gru = read_u32(12) == 1;
+    const Eigen::Index input_size = read_u32(16);
+    const Eigen::Index hidden_size = read_u32(20);
+    const Eigen::Index gate_size = read_u32(24);
+    const Eigen::Index output_size = read_u32(28);
+    const Eigen::Index rank = read_u32(32);
+    const auto num_blocks = static_cast<std::size_t>(read_u32(36));
+    if (gate_size != (gru ? 3 : 4) * hidden_size)
+        throw std::runtime_error(path + " has an inconsistent gate size");
+    // The sample and the two conditioning inputs, and a single output
+    if (input_size < 3 || output_size != 1)
+        throw std::runtime_error(path + " needs at least 3 inputs and 1 output");
+    if (file->size() < header_size + num_blocks * entry_size)
+        throw std::runtime_error(path + " is truncated");
+
+    const auto find_block = [&](const char* name, block_type type, Eigen::Index rows, Eigen::Index cols, bool required) -> const void* {
+        const auto element_size = type == int8 ? sizeof(std::int8_t) : sizeof(float);
+        for (std::size_t i = 0; i < num_blocks; i++) {
+            const auto entry = header_size + i * entry_size;
+            if (std::strncmp(reinterpret_cast<const char*>(bytes + entry), name, 32) != 0)
+                continue;
+
+            const auto offset = read_u64(entry + 48);
+            const auto size = read_u64(entry + 56);
+            if (read_u32(entry + 32) != type || read_u32(entry + 36) != rows || read_u32(entry + 40) != cols
+                || size != static_cast<std::uint64_t>(rows * cols) * element_size || offset % 16 != 0 || offset + size > file->size())
+                throw std::runtime_error(path + ": block " + name + " does not match the model");
+            return bytes + offset;
+        }
+
+        if (required)
+            throw std::runtime_error(path + ": missing block " + name);
+        return nullptr;
+    };
+    const auto find_floats = [&](const char* name, Eigen::Index rows, Eigen::Index cols) {
+        return static_cast<const float*>(find_block(name, float32, rows, cols, true));
+    };
+
+    struct binary_weights {
+        std::shared_ptr<mapped_file> file;
+        row_major_matrix weight_hh;
+        Eigen::RowVectorXf recurrent_bias;
+    };
+    auto weights = std::make_shared<binary_weights>();
+    weights->file = file;
+
+    recurrent_model model;
+    model.gru = gru;
+    set_view(model.weight_ih, find_floats("weight_ih", gate_size, input_size), input_size, gate_size);
+    set_view(model.bias, find_floats("bias", gate_size, 1), gate_size);
+    set_view(model.linear_weight, find_floats("linear_weight", output_size, hidden_size), hidden_size, output_size);
+    set_view(model.linear_bias, find_floats("linear_bias", output_size, 1), output_size);
+
+    // Exactly one form of the recurrent weights, see RecurrentWeights in the plugin
+    using column_major_view = Eigen::Map<const Eigen::MatrixXf>;
+    if (rank > 0) {
+        const column_major_view u(find_floats("weight_hh_u", gate_size, rank), gate_size, rank);
+        const column_major_view v(find_floats("weight_hh_v", rank, hidden_size), rank, hidden_size);
+        weights->weight_hh = (u * v).transpose();
+        set_view(model.weight_hh, weights->weight_hh.data(), hidden_size, gate_size);
+    } else if (const auto* weight_hh = find_block("weight_hh", float32, gate_size, hidden_size, false)) {
+        set_view(model.weight_hh, static_cast<const float*>(weight_hh), hidden_size, gate_size);
+    } else {
+        // Row-major gates x hidden int8 values with one scale per gate row
+        const auto* values = static_cast<const std::int8_t*>(find_block("weight_hh_int8", int8, gate_size, hidden_size, true));
+        const Eigen::Map<const Eigen::Matrix<std::int8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> quantized(values, gate_size, hidden_size);
+        const Eigen::Map<const Eigen::VectorXf> scales(find_floats("weight_hh_scale", gate_size, 1), gate_size);
+        weights->weight_hh = (quantized.cast<float>().array().colwise() * scales.array()).matrix().transpose();
+        set_view(model.weight_hh, weights->weight_hh.data(), hidden_size, gate_size);
+    }
+
+    // The binary model keeps only the new gate's part of the recurrent bias
+    if (gru) {
+        weights->recurrent_bias = Eigen::RowVectorXf::Zero(gate_size);
+        weights->recurrent_bias.tail(hidden_size) = Eigen::Map<const Eigen::RowVectorXf>(find_floats("recurrent_bias", hidden_size, 1), hidden_size);
+        set_view(model.recurrent_bias, weights->recurrent_bias.data(), gate_size);
+    }
+
+    model.storage = weights;
+    return model;
+}
+
+// Binary models are told apart from JSON exports by their magic
+inline recurrent_model load_model(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    char magic[8] {};
+    file.read(magic, sizeof(magic));
+    if (file && std::memcmp(magic, "DDS19MDL", sizeof(magic)) == 0)
+        return load_model_binary(path);
+
+    return load_model_json(path);
+}
+
+// Copy of the model running its recurrent product on int8 weights
+inline recurrent_model quantize_model(recurrent_model model)
+{
+    model.weight_hh_int8 = quantize_rows(model.weight_hh.transpose());
+    model.int8 = true;
+    return model;
+}
+
+// Everything a render mutates, one per thread
+struct recurrent_state {
+    Eigen::RowVectorXf effective_bias;
+    Eigen::RowVectorXf gates;
+    Eigen::RowVectorXf recurrent;
+    Eigen::RowVectorXf c;
+    Eigen::RowVectorXf h;
+    Eigen::RowVectorXf output;
+    int16_row_vector h_int16;
+
+    // Clears the state and folds S/F and DELAY FINE, constant for a whole
+    // render, into the bias
+    void reset(const recurrent_model& model, float sf, float delay_fine)
+    {
+        const auto gate_size = model.weight_ih.cols();
+        const auto hidden_size = model.weight_hh.rows();
+        effective_bias = model.bias + sf * model.weight_ih.row(1) + delay_fine * model.weight_ih.row(2);
+        gates.setZero(gate_size);
+        recurrent.setZero(gate_size);
+        c.setZero(hidden_size);
+        h.setZero(hidden_size);
+        h_int16.setZero(hidden_size);
+        output.setZero(model.linear_weight.cols());
+    }
+};
+
+// Continues from the given state, so a long input can be rendered in pieces
+template <activation_mode mode>
+void render(const recurrent_model& model, recurrent_state& state, const float* input, float* rendered, std::size_t num_samples)
+{
+    auto& gates = state.gates;
+    auto& recurrent = state.recurrent;
+    auto& h = state.h;
+    for (std::size_t i = 0; i < num_samples; i++) {
+        const auto sample = input[i];
+        if (model.gru) {
+            gates = sample * model.weight_ih.row(0) + state.effective_bias;
+            if (model.int8) {
+                recurrent = model.recurrent_bias;
+                add_product_int8(model.weight_hh_int8, h, state.h_int16, recurrent);
+            } else {
+                recurrent.noalias() = h * model.weight_hh;
+                recurrent += model.recurrent_bias;
+            }
+            gru_activate<mode>(gates, recurrent, h);
+        } else {
+            if (model.int8) {
+                gates = sample * model.weight_ih.row(0) + state.effective_bias;
+                add_product_int8(model.weight_hh_int8, h, state.h_int16, gates);
+            } else {
+                gates.noalias() = h * model.weight_hh;
+                gates += sample * model.weight_ih.row(0) + state.effective_bias;
+            }
+            lstm_activate<mode>(gates, state.c, h);
+        }
+
+        // Linear
+        state.output = h * model.linear_weight + model.linear_bias;
+        rendered[i] = state.output.value();
+    }
+}
+
+inline void render(activation_mode mode, const recurrent_model& model, recurrent_state& state, const float* input, float* rendered, std::size_t num_samples)
+{
+    switch (mode) {
+    case activation_mode::fast:
+        return render<activation_mode::fast>(model, state, input, rendered, num_samples);
+    case activation_mode::ultra_fast:
+        return render<activation_mode::ultra_fast>(model, state, input, rendered, num_samples);
+    default:
+        return render<activation_mode::exact>(model, state, input, rendered, num_samples);
+    }
+}
+
+// Several streams stepped together, one per row. The recurrent products of
+// all streams become a single matrix product, which reads the weights once
+// per step for the whole batch, and the input projection of a sample is
+// shared by every stream of its channel. fp32 weights only.
+struct batch_state {
+    Eigen::Index num_channels { 1 };
+    Eigen::Index streams_per_channel { 1 };
+    Eigen::MatrixXf effective_bias;
+    Eigen::RowVectorXf projection;
+    Eigen::MatrixXf gates;
+    Eigen::MatrixXf recurrent;
+    Eigen::MatrixXf c;
+    Eigen::MatrixXf h;
+    Eigen::VectorXf output;
+
+    // One stream per channel and (S/F, DELAY FINE) pair, in channel major order
+    void reset(const recurrent_model& model, const std::vector<std::pair<float, float>>& conditioning, Eigen::Index channels)
+    {
+        const auto gate_size = model.weight_ih.cols();
+        const auto hidden_size = model.weight_hh.rows();
+        num_channels = channels;
+        streams_per_channel = static_cast<Eigen::Index>(conditioning.size());
+        const auto num_streams = num_channels * streams_per_channel;
+
+        effective_bias.resize(num_streams, gate_size);
+        for (Eigen::Index stream = 0; stream < num_streams; stream++) {
+            const auto& [sf, delay_fine] = conditioning[static_cast<std::size_t>(stream % streams_per_channel)];
+            effective_bias.row(stream) = model.bias + sf * model.weight_ih.row(1) + delay_fine * model.weight_ih.row(2);
+        }
+        projection.setZero(gate_size);
+        gates.setZero(num_streams, gate_size);
+        recurrent.setZero(num_streams, gate_size);
+        c.setZero(num_streams, hidden_size);
+        h.setZero(num_streams, hidden_size);
+        output.setZero(num_streams);
+    }
+};
+
+// frames holds num_frames interleaved frames of num_channels. rendered gets
+// one frame of all streams per input frame, in the stream order of the state.
+template <activation_mode mode>
+void render_batch(const recurrent_model& model, batch_state& state, const float* frames, std::size_t num_frames, float* rendered)
+{
+    const auto num_channels = state.num_channels;
+    const auto streams_per_channel = state.streams_per_channel;
+    const auto num_streams = num_channels * streams_per_channel;
+    for (std::size_t i = 0; i < num_frames; i++) {
+        if (model.gru) {
+            state.recurrent.noalias() = state.h * model.weight_hh;
+            state.recurrent.rowwise() += model.recurrent_bias;
+            state.gates = state.effective_bias;
+        } else {
+            state.gates.noalias() = state.h * model.weight_hh;
+            state.gates += state.effective_bias;
+        }
+
+        for (Eigen::Index channel = 0; channel < num_channels; channel++) {
+            state.projection = frames[i * static_cast<std::size_t>(num_channels) + static_cast<std::size_t>(channel)] * model.weight_ih.row(0);
+            state.gates.middleRows(channel * streams_per_channel, streams_per_channel).rowwise() += state.projection;
+        }
+
+        if (model.gru)
+            gru_activate<mode>(state.gates, state.recurrent, state.h);
+        else
+            lstm_activate<mode>(state.gates, state.c, state.h);
+
+        // Linear
+        state.output.noalias() = state.h * model.linear_weight;
+        state.output.array() += model.linear_bias.value();
+        Eigen::Map<Eigen::VectorXf>(rendered + i * static_cast<std::size_t>(num_streams), num_streams) = state.output;
+    }
+}
+
+inline void render_batch(activation_mode mode, const recurrent_model& model, batch_state& state, const float* frames, std::size_t num_frames, float* rendered)
+{
+    switch (mode) {
+    case activation_mode::fast:
+        return render_batch<activation_mode::fast>(model, state, frames, num_frames, rendered);
+    case activation_mode::ultra_fast:
+        return render_batch<activation_mode::ultra_fast>(model, state, frames, num_frames, rendered);
+    default:
+        return render_batch<activation_mode::exact>(model, state, frames, num_frames, rendered);
+    }
+}
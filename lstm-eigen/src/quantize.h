@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+
+// int8 weights with one scale per row, the scheme of quantize_state in
+// dds-nn/model.py: weights(row, col) ~= values(row, col) * scale(row). The
+// values are kept widened to int16, so every row is a plain int16 dot product
+// that compilers vectorise with pmaddwd and similar instructions.
+struct quantized_matrix {
+    Eigen::Matrix<std::int16_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> values;
+    Eigen::VectorXf scale;
+};
+
+inline quantized_matrix quantize_rows(const Eigen::MatrixXf& weights)
+{
+    quantized_matrix quantized;
+    quantized.scale = weights.rowwise().lpNorm<Eigen::Infinity>().cwiseMax(1e-12f) / 127.0f;
+    quantized.values = (weights.array().colwise() / quantized.scale.array()).round().cwiseMax(-127.0f).cwiseMin(127.0f).cast<std::int16_t>();
+    return quantized;
+}
+
+using int16_row_vector = Eigen::Matrix<std::int16_t, 1, Eigen::Dynamic>;
+
+// out += weights * x for x in [-1, 1]. x is quantized to int16 with a fixed
+// scale into x_int16, sized like x by the caller, and the dot products
+// accumulate in int32.
+inline void add_product_int8(const quantized_matrix& weights, const Eigen::RowVectorXf& x, int16_row_vector& x_int16, Eigen::RowVectorXf& out)
+{
+    constexpr auto x_scale { 32767.0f };
+    constexpr auto sum_scale { 1.0f / x_scale };
+    x_int16 = (x.array() * x_scale).round().cast<std::int16_t>();
+    const auto num_cols = x_int16.size();
+    for (auto row = 0; row < weights.values.rows(); row++) {
+        const auto* values = weights.values.row(row).data();
+        std::int32_t sum = 0;
+        for (auto col = 0; col < num_cols; col++)
+            sum += values[col] * x_int16[col];
+        out[row] += static_cast<float>(sum) * sum_scale * weights.scale[row];
+    }
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers, each with its own job deque. A worker takes jobs from
+// the back of its own deque and, once that is empty, steals from the front of
+// the others, so uneven jobs (long and short files) still keep every core
+// busy. Jobs receive the index of the worker running them, which selects the
+// worker's private state.
+class work_stealing_pool {
+public:
+    using job = std::function<void(std::size_t worker)>;
+
+    explicit work_stealing_pool(std::size_t num_workers)
+    {
+        num_workers = std::max<std::size_t>(1, num_workers);
+        for (std::size_t i = 0; i < num_workers; i++)
+            queues.push_back(std::make_unique<job_queue>());
+        for (std::size_t i = 0; i < num_workers; i++)
+            threads.emplace_back([this, i] { run(i); });
+    }
+
+    ~work_stealing_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    std::size_t size() const { return queues.size(); }
+
+    // Jobs submitted from a worker go to its own deque, others are dealt out
+    // round robin
+    void submit(job new_job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            num_pending++;
+            num_queued++;
+        }
+
+        const auto worker = current_pool() == this ? current_worker() : next_queue++ % size();
+        {
+            std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+            queues[worker]->jobs.push_back(std::move(new_job));
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until every submitted job has finished and rethrows the first
+    // exception a job threw. Not to be called from a job.
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return num_pending == 0; });
+        if (error) {
+            auto first_error = error;
+            error = nullptr;
+            std::rethrow_exception(first_error);
+        }
+    }
+
+private:
+    struct job_queue {
+        std::mutex mutex;
+        std::deque<job> jobs;
+    };
+
+    static const work_stealing_pool*& current_pool()
+    {
+        thread_local const work_stealing_pool* pool { nullptr };
+        return pool;
+    }
+
+    static std::size_t& current_worker()
+    {
+        thread_local std::size_t worker { 0 };
+        return worker;
+    }
+
+    bool try_pop(std::size_t worker, job& next_job)
+    {
+        for (std::size_t i = 0; i < size(); i++) {
+            auto& queue = *queues[(worker + i) % size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty())
+                continue;
+
+            if (i == 0) {
+                next_job = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+            } else {
+                next_job = std::move(queue.jobs.front());
+                queue.jobs.pop_front();
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    void run(std::size_t worker)
+    {
+        current_pool() = this;
+        current_worker() = worker;
+        while (true) {
+            job next_job;
+            if (try_pop(worker, next_job)) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    num_queued--;
+                }
+
+                std::exception_ptr job_error;
+                try {
+                    next_job(worker);
+                } catch (...) {
+                    job_error = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (job_error && !error)
+                    error = job_error;
+                if (--num_pending == 0)
+                    done.notify_all();
+                continue;
+            }
+
+            // num_queued is counted before the push, so a worker may wake up
+            // just ahead of its job and go round once more
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || num_queued > 0; });
+            if (stopping && num_queued == 0)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<job_queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<std::size_t> next_queue { 0 };
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::size_t num_pending { 0 };
+    std::size_t num_queued { 0 };
+    bool stopping { false };
+    std::exception_ptr error;
+};
@@ -0,0 +1,344 @@
+#pragma once
+
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Streaming WAV input and output with memory use independent of the file
+// length. Samples are exchanged as interleaved floats in [-1, 1]. Integer PCM
+// of 8 to 32 bits and 32 or 64-bit float are read, from RIFF or RF64 files.
+// Samples are stored little endian, as on every platform this runs on.
+struct wav_format {
+    int num_channels { 1 };
+    int sample_rate { 44100 };
+    int bits_per_sample { 16 };
+    bool is_float { false };
+
+    std::size_t bytes_per_frame() const { return static_cast<std::size_t>(num_channels * bits_per_sample / 8); }
+};
+
+namespace wav_detail {
+inline std::uint16_t read_u16(const unsigned char* bytes)
+{
+    return static_cast<std::uint16_t>(bytes[0] | bytes[1] << 8);
+}
+
+inline std::uint32_t read_u32(const unsigned char* bytes)
+{
+    return static_cast<std::uint32_t>(read_u16(bytes)) | static_cast<std::uint32_t>(read_u16(bytes + 2)) << 16;
+}
+
+inline std::uint64_t read_u64(const unsigned char* bytes)
+{
+    return static_cast<std::uint64_t>(read_u32(bytes)) | static_cast<std::uint64_t>(read_u32(bytes + 4)) << 32;
+}
+
+inline void put_u16(unsigned char* bytes, std::uint16_t value)
+{
+    bytes[0] = static_cast<unsigned char>(value);
+    bytes[1] = static_cast<unsigned char>(value >> 8);
+}
+
+inline void put_u32(unsigned char* bytes, std::uint32_t value)
+{
+    put_u16(bytes, static_cast<std::uint16_t>(value));
+    put_u16(bytes + 2, static_cast<std::uint16_t>(value >> 16));
+}
+
+inline void put_u64(unsigned char* bytes, std::uint64_t value)
+{
+    put_u32(bytes, static_cast<std::uint32_t>(value));
+    put_u32(bytes + 4, static_cast<std::uint32_t>(value >> 32));
+}
+
+constexpr std::uint16_t format_pcm { 1 };
+constexpr std::uint16_t format_float { 3 };
+constexpr std::uint16_t format_extensible { 0xfffe };
+}
+
+// Maps the input and decodes it chunk by chunk. Each read prefetches the next
+// chunk, so the disk works while the caller renders, and releases the pages
+// it has decoded.
+class wav_reader {
+public:
+    explicit wav_reader(const std::string& path)
+        : file(path)
+    {
+        using namespace wav_detail;
+        const auto* bytes = file.data();
+        const auto size = file.size();
+        if (size < 12 || (std::memcmp(bytes, "RIFF", 4) != 0 && std::memcmp(bytes, "RF64", 4) != 0) || std::memcmp(bytes + 8, "WAVE", 4) != 0)
+            throw std::runtime_error(path + " is not a WAV file");
+
+        std::uint64_t data_size_64 { 0 };
+        auto has_format = false;
+        for (std::size_t position = 12; position + 8 <= size;) {
+            const auto* chunk = bytes + position;
+            std::uint64_t chunk_size = read_u32(chunk + 4);
+            const auto body = position + 8;
+
+            if (std::memcmp(chunk, "ds64", 4) == 0 && chunk_size >= 16 && body + 16 <= size) {
+                data_size_64 = read_u64(chunk + 16);
+            } else if (std::memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 && body + 16 <= size) {
+                auto tag = read_u16(chunk + 8);
+                if (tag == format_extensible && chunk_size >= 26 && body + 26 <= size)
+                    tag = read_u16(chunk + 32);
+                format.num_channels = read_u16(chunk + 10);
+                format.sample_rate = static_cast<int>(read_u32(chunk + 12));
+                format.bits_per_sample = read_u16(chunk + 22);
+                format.is_float = tag == format_float;
+                if ((tag != format_pcm && tag != format_float) || format.num_channels == 0
+                    || (format.is_float && format.bits_per_sample != 32 && format.bits_per_sample != 64)
+                    || (!format.is_float && (format.bits_per_sample % 8 != 0 || format.bits_per_sample < 8 || format.bits_per_sample > 32)))
+                    throw std::runtime_error(path + " has an unsupported sample format");
+                has_format = true;
+            } else if (std::memcmp(chunk, "data", 4) == 0) {
+                if (!has_format)
+                    throw std::runtime_error(path + " has no format before its data");
+                if (chunk_size == 0xffffffff && data_size_64 > 0)
+                    chunk_size = data_size_64;
+
+                // Files still being written or cut short keep what is there
+                data_offset = body;
+                num_frames_total = std::min<std::uint64_t>(chunk_size, size - body) / format.bytes_per_frame();
+                return;
+            }
+
+            position = body + static_cast<std::size_t>(chunk_size) + (chunk_size & 1);
+        }
+
+        throw std::runtime_error(path + " has no audio data");
+    }
+
+    const wav_format& get_format() const { return format; }
+    std::size_t get_num_frames() const { return num_frames_total; }
+
+    // Decodes up to max_frames interleaved frames and returns how many were read
+    std::size_t read(float* frames, std::size_t max_frames)
+    {
+        const auto count = read(position, frames, max_frames);
+        position += count;
+        return count;
+    }
+
+    // Same from any frame, without moving the read position. Safe to call
+    // from several threads at once.
+    std::size_t read(std::size_t first_frame, float* frames, std::size_t max_frames) const
+    {
+        const auto count = std::min(max_frames, num_frames_total - std::min(first_frame, num_frames_total));
+        const auto bytes_per_frame = format.bytes_per_frame();
+        const auto offset = data_offset + first_frame * bytes_per_frame;
+        file.prefetch(offset + count * bytes_per_frame, count * bytes_per_frame);
+
+        const auto* bytes = file.data() + offset;
+        const auto num_samples = count * static_cast<std::size_t>(format.num_channels);
+        for (std::size_t i = 0; i < num_samples; i++)
+            frames[i] = decode(bytes + i * static_cast<std::size_t>(format.bits_per_sample / 8));
+
+        file.release(offset, count * bytes_per_frame);
+        return count;
+    }
+
+private:
+    float decode(const unsigned char* bytes) const
+    {
+        using namespace wav_detail;
+        if (format.is_float) {
+            if (format.bits_per_sample == 64) {
+                const auto bits = read_u64(bytes);
+                double value;
+                std::memcpy(&value, &bits, sizeof(value));
+                return static_cast<float>(value);
+            }
+            const auto bits = read_u32(bytes);
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        switch (format.bits_per_sample) {
+        case 8:
+            return (static_cast<float>(bytes[0]) - 128.0f) / 128.0f;
+        case 16:
+            return static_cast<float>(static_cast<std::int16_t>(read_u16(bytes))) / 32768.0f;
+        case 24: {
+            // Placed in the top three bytes, so the sign carries over
+            const auto value = static_cast<std::int32_t>(static_cast<std::uint32_t>(bytes[0]) << 8 | static_cast<std::uint32_t>(bytes[1]) << 16 | static_cast<std::uint32_t>(bytes[2]) << 24);
+            return static_cast<float>(value / 256) / 8388608.0f;
+        }
+        default:
+            return static_cast<float>(static_cast<std::int32_t>(read_u32(bytes)) / 2147483648.0);
+        }
+    }
+
+    mapped_file file;
+    wav_format format;
+    std::size_t data_offset { 0 };
+    std::size_t num_frames_total { 0 };
+    std::size_t position { 0 };
+};
+
+// Writes 16 or 24-bit PCM or 32-bit float in chunks. The caller fills one
+// buffer while the previous one is encoded and written on another thread.
+// The header is patched on close and turns into RF64 when the data outgrows
+// the 4 GB of RIFF.
+class wav_writer {
+public:
+    wav_writer(const std::string& path, const wav_format& output_format, std::size_t chunk_frames)
+        : format(output_format)
+        , max_frames(chunk_frames)
+    {
+        if (format.is_float || format.bits_per_sample > 24) {
+            format.is_float = true;
+            format.bits_per_sample = 32;
+        } else {
+            format.bits_per_sample = std::max(16, format.bits_per_sample);
+        }
+
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr)
+            throw std::runtime_error("Cannot write " + path);
+
+        for (auto& buffer : buffers)
+            buffer.resize(max_frames * static_cast<std::size_t>(format.num_channels));
+        encoded.resize(max_frames * format.bytes_per_frame());
+        write_header(0);
+    }
+
+    ~wav_writer()
+    {
+        try {
+            close();
+        } catch (...) {
+        }
+    }
+
+    wav_writer(const wav_writer&) = delete;
+    wav_writer& operator=(const wav_writer&) = delete;
+
+    const wav_format& get_format() const { return format; }
+
+    // The buffer for the next chunk, room for the chunk size given at construction
+    float* get_buffer() { return buffers[next].data(); }
+
+    // Queues the first num_frames frames of the buffer and waits for the
+    // chunk before it, whose buffer becomes the next one to fill
+    void write(std::size_t num_frames)
+    {
+        wait_for_pending();
+        pending = std::async(std::launch::async, [this, buffer = next, num_frames] { write_frames(buffers[buffer].data(), num_frames); });
+        next = 1 - next;
+    }
+
+    void close()
+    {
+        if (file == nullptr)
+            return;
+
+        wait_for_pending();
+        const auto data_size = num_frames_written * format.bytes_per_frame();
+        if (data_size & 1)
+            std::fputc(0, file);
+        std::fseek(file, 0, SEEK_SET);
+        write_header(data_size);
+        const auto failed = std::fclose(file) != 0;
+        file = nullptr;
+        if (failed)
+            throw std::runtime_error("Cannot write WAV file");
+    }
+
+private:
+    static constexpr std::size_t header_size { 80 };
+
+    void wait_for_pending()
+    {
+        if (pending.valid())
+            pending.get();
+    }
+
+    void write_frames(const float* frames, std::size_t num_frames)
+    {
+        const auto num_samples = num_frames * static_cast<std::size_t>(format.num_channels);
+        const auto sample_bytes = static_cast<std::size_t>(format.bits_per_sample / 8);
+        for (std::size_t i = 0; i < num_samples; i++)
+            encode(frames[i], encoded.data() + i * sample_bytes);
+
+        if (std::fwrite(encoded.data(), sample_bytes, num_samples, file) != num_samples)
+            throw std::runtime_error("Cannot write WAV file");
+        num_frames_written += num_frames;
+    }
+
+    void encode(float sample, unsigned char* bytes) const
+    {
+        using namespace wav_detail;
+        if (format.is_float) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &sample, sizeof(bits));
+            put_u32(bytes, bits);
+            return;
+        }
+
+        const auto clamped = std::clamp(sample, -1.0f, 1.0f);
+        if (format.bits_per_sample == 16) {
+            put_u16(bytes, static_cast<std::uint16_t>(static_cast<std::int16_t>(std::lround(clamped * 32767.0f))));
+        } else {
+            const auto value = static_cast<std::uint32_t>(static_cast<std::int32_t>(std::lround(clamped * 8388607.0f)));
+            bytes[0] = static_cast<unsigned char>(value);
+            bytes[1] = static_cast<unsigned char>(value >> 8);
+            bytes[2] = static_cast<unsigned char>(value >> 16);
+        }
+    }
+
+    // RIFF, a JUNK chunk that becomes ds64 for RF64, fmt and the data header
+    void write_header(std::uint64_t data_size)
+    {
+        using namespace wav_detail;
+        unsigned char header[header_size] {};
+        const auto riff_size = header_size - 8 + data_size + (data_size & 1);
+        const auto is_rf64 = riff_size > 0xffffffff;
+
+        std::memcpy(header, is_rf64 ? "RF64" : "RIFF", 4);
+        put_u32(header + 4, is_rf64 ? 0xffffffff : static_cast<std::uint32_t>(riff_size));
+        std::memcpy(header + 8, "WAVE", 4);
+
+        std::memcpy(header + 12, is_rf64 ? "ds64" : "JUNK", 4);
+        put_u32(header + 16, 28);
+        if (is_rf64) {
+            put_u64(header + 20, riff_size);
+            put_u64(header + 28, data_size);
+            put_u64(header + 36, num_frames_written);
+        }
+
+        std::memcpy(header + 48, "fmt ", 4);
+        put_u32(header + 52, 16);
+        put_u16(header + 56, format.is_float ? format_float : format_pcm);
+        put_u16(header + 58, static_cast<std::uint16_t>(format.num_channels));
+        put_u32(header + 60, static_cast<std::uint32_t>(format.sample_rate));
+        put_u32(header + 64, static_cast<std::uint32_t>(static_cast<std::size_t>(format.sample_rate) * format.bytes_per_frame()));
+        put_u16(header + 68, static_cast<std::uint16_t>(format.bytes_per_frame()));
+        put_u16(header + 70, static_cast<std::uint16_t>(format.bits_per_sample));
+
+        std::memcpy(header + 72, "data", 4);
+        put_u32(header + 76, is_rf64 ? 0xffffffff : static_cast<std::uint32_t>(data_size));
+
+        if (std::fwrite(header, 1, header_size, file) != header_size)
+            throw std::runtime_error("Cannot write WAV file");
+    }
+
+    wav_format format;
+    std::size_t max_frames;
+    std::FILE* file { nullptr };
+    std::vector<float> buffers[2];
+    std::vector<unsigned char> encoded;
+    int next { 0 };
+    std::future<void> pending;
+    std::uint64_t num_frames_written { 0 };
+};